@@ -0,0 +1,433 @@
+// SPDX-FileCopyrightText: (c) 2025 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <random>
+
+import panima;
+
+// Counts all heap allocations of the process, used to verify that the steady-state playback doesn't allocate
+static std::atomic<uint64_t> g_allocationCount = 0;
+void *operator new(std::size_t size)
+{
+	g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+	if(auto *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc {};
+}
+void *operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+// Set if any benchmark reported an error, in which case the process exits with a non-zero code.
+// SkipWithError alone only marks the run, which would go unnoticed in CI.
+static std::atomic<bool> g_failed = false;
+static void fail(benchmark::State &state, const char *msg)
+{
+	g_failed = true;
+	state.SkipWithError(msg);
+}
+
+// All synthetic data is generated from fixed seeds, so that results are reproducible between runs
+namespace {
+	constexpr uint32_t SEED = 0x5eed;
+	constexpr float FRAME_TIME = 1.f / 30.f;
+
+	template<typename T>
+	T random_value(std::mt19937 &rng)
+	{
+		std::uniform_real_distribution<float> dist {-1.f, 1.f};
+		if constexpr(std::is_same_v<T, float>)
+			return dist(rng);
+		else if constexpr(std::is_same_v<T, udm::Vector3>)
+			return udm::Vector3 {dist(rng), dist(rng), dist(rng)};
+		else if constexpr(std::is_same_v<T, udm::Quaternion>)
+			return uquat::create(EulerAngles {dist(rng) * 180.f, dist(rng) * 180.f, dist(rng) * 180.f});
+	}
+
+	template<typename T>
+	void generate_keyframes(uint32_t n, std::vector<float> &outTimes, std::vector<T> &outValues, uint32_t seed = SEED)
+	{
+		std::mt19937 rng {seed};
+		outTimes.resize(n);
+		outValues.resize(n);
+		for(auto i = decltype(n) {0u}; i < n; ++i) {
+			outTimes[i] = static_cast<float>(i) * FRAME_TIME;
+			outValues[i] = random_value<T>(rng);
+		}
+	}
+
+	template<typename T>
+	panima::Channel &generate_channel(panima::Animation &anim, const std::string &path, uint32_t n, uint32_t seed = SEED)
+	{
+		auto &channel = *anim.AddChannel(path, udm::type_to_enum<T>());
+		std::vector<float> times;
+		std::vector<T> values;
+		generate_keyframes<T>(n, times, values, seed);
+		channel.InsertValues<T>(n, times.data(), values.data());
+		channel.Update();
+		return channel;
+	}
+
+	// Smooth curve with a small amount of noise, which is representative of baked or recorded animation data
+	panima::Channel &generate_noisy_curve(panima::Animation &anim, uint32_t n)
+	{
+		auto &channel = *anim.AddChannel("curve", udm::Type::Float);
+		std::mt19937 rng {SEED};
+		std::uniform_real_distribution<float> noise {-0.01f, 0.01f};
+		std::vector<float> times(n);
+		std::vector<float> values(n);
+		for(auto i = decltype(n) {0u}; i < n; ++i) {
+			times[i] = static_cast<float>(i) * FRAME_TIME;
+			values[i] = std::sin(times[i]) + noise(rng);
+		}
+		channel.InsertValues<float>(n, times.data(), values.data());
+		channel.Update();
+		return channel;
+	}
+
+	std::shared_ptr<panima::Animation> generate_animation(uint32_t numChannels, uint32_t numKeyframes)
+	{
+		auto anim = std::make_shared<panima::Animation>();
+		for(auto i = decltype(numChannels) {0u}; i < numChannels; ++i) {
+			auto bone = "bone" + std::to_string(i / 2);
+			if((i % 2) == 0)
+				generate_channel<udm::Vector3>(*anim, bone + "/position", numKeyframes, SEED + i);
+			else
+				generate_channel<udm::Quaternion>(*anim, bone + "/rotation", numKeyframes, SEED + i);
+		}
+		anim->SetDuration(static_cast<float>(numKeyframes - 1) * FRAME_TIME);
+		return anim;
+	}
+};
+
+// Sequential playback, the pivot is almost always in the same or the next segment
+static void BM_FindInterpolationIndices_CursorHit(benchmark::State &state)
+{
+	auto numKeyframes = static_cast<uint32_t>(state.range(0));
+	panima::Animation anim;
+	auto &channel = generate_channel<float>(anim, "value", numKeyframes);
+	auto duration = channel.GetMaxTime();
+	auto t = 0.f;
+	uint32_t pivot = 0;
+	for(auto _ : state) {
+		float f;
+		auto indices = channel.FindInterpolationIndices(t, f, pivot);
+		pivot = indices.first;
+		benchmark::DoNotOptimize(indices);
+		t += FRAME_TIME * 0.25f;
+		if(t > duration)
+			t = 0.f;
+	}
+}
+BENCHMARK(BM_FindInterpolationIndices_CursorHit)->Range(64, 64 << 10);
+
+// Random seeks, the pivot is almost never usable
+static void BM_FindInterpolationIndices_CursorMiss(benchmark::State &state)
+{
+	auto numKeyframes = static_cast<uint32_t>(state.range(0));
+	panima::Animation anim;
+	auto &channel = generate_channel<float>(anim, "value", numKeyframes);
+	std::mt19937 rng {SEED};
+	std::uniform_real_distribution<float> dist {0.f, channel.GetMaxTime()};
+	std::vector<float> times(1024);
+	for(auto &t : times)
+		t = dist(rng);
+	size_t i = 0;
+	uint32_t pivot = 0;
+	for(auto _ : state) {
+		float f;
+		auto indices = channel.FindInterpolationIndices(times[i++ % times.size()], f, pivot);
+		pivot = indices.first;
+		benchmark::DoNotOptimize(indices);
+	}
+}
+BENCHMARK(BM_FindInterpolationIndices_CursorMiss)->Range(64, 64 << 10);
+
+template<typename T>
+static void BM_GetInterpolatedValue(benchmark::State &state)
+{
+	panima::Animation anim;
+	auto &channel = generate_channel<T>(anim, "value", 1024);
+	auto duration = channel.GetMaxTime();
+	auto t = 0.f;
+	uint32_t pivot = 0;
+	for(auto _ : state) {
+		benchmark::DoNotOptimize(channel.GetInterpolatedValue<T>(t, pivot));
+		t += FRAME_TIME * 0.25f;
+		if(t > duration)
+			t = 0.f;
+	}
+}
+BENCHMARK_TEMPLATE(BM_GetInterpolatedValue, float);
+BENCHMARK_TEMPLATE(BM_GetInterpolatedValue, udm::Vector3);
+BENCHMARK_TEMPLATE(BM_GetInterpolatedValue, udm::Quaternion);
+
+static void BM_AddValue(benchmark::State &state)
+{
+	auto n = static_cast<uint32_t>(state.range(0));
+	std::vector<float> times;
+	std::vector<udm::Vector3> values;
+	generate_keyframes<udm::Vector3>(n, times, values);
+	for(auto _ : state) {
+		panima::Animation anim;
+		auto &channel = *anim.AddChannel("value", udm::Type::Vector3);
+		for(auto i = decltype(n) {0u}; i < n; ++i)
+			channel.AddValue<udm::Vector3>(times[i], values[i]);
+		benchmark::DoNotOptimize(channel.GetValueCount());
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_AddValue)->Range(256, 16 << 10);
+
+// Inserts a block of keyframes into the middle of an existing channel
+static void BM_InsertValues(benchmark::State &state)
+{
+	auto n = static_cast<uint32_t>(state.range(0));
+	std::vector<float> times;
+	std::vector<udm::Vector3> values;
+	generate_keyframes<udm::Vector3>(n, times, values, SEED + 1);
+	for(auto _ : state) {
+		state.PauseTiming();
+		panima::Animation anim;
+		auto &channel = generate_channel<udm::Vector3>(anim, "value", n);
+		auto offset = channel.GetMaxTime() * 0.5f;
+		state.ResumeTiming();
+		channel.InsertValues<udm::Vector3>(n, times.data(), values.data(), offset);
+		benchmark::DoNotOptimize(channel.GetValueCount());
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_InsertValues)->Range(256, 64 << 10);
+
+static void BM_ClearRange(benchmark::State &state)
+{
+	auto n = static_cast<uint32_t>(state.range(0));
+	for(auto _ : state) {
+		state.PauseTiming();
+		panima::Animation anim;
+		auto &channel = generate_channel<udm::Vector3>(anim, "value", n);
+		auto duration = channel.GetMaxTime();
+		state.ResumeTiming();
+		channel.ClearRange(duration * 0.25f, duration * 0.75f);
+		benchmark::DoNotOptimize(channel.GetValueCount());
+	}
+}
+BENCHMARK(BM_ClearRange)->Range(256, 64 << 10);
+
+// Every keyframe is duplicated, so half of them can be removed
+static void BM_Optimize(benchmark::State &state)
+{
+	auto n = static_cast<uint32_t>(state.range(0));
+	std::vector<float> times;
+	std::vector<udm::Vector3> values;
+	generate_keyframes<udm::Vector3>(n, times, values);
+	for(auto i = decltype(n) {1u}; i < n; i += 2)
+		values[i] = values[i - 1];
+	for(auto _ : state) {
+		state.PauseTiming();
+		panima::Animation anim;
+		auto &channel = *anim.AddChannel("value", udm::Type::Vector3);
+		channel.InsertValues<udm::Vector3>(n, times.data(), values.data());
+		state.ResumeTiming();
+		benchmark::DoNotOptimize(channel.Optimize());
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_Optimize)->Range(256, 64 << 10);
+
+static void BM_Decimate(benchmark::State &state)
+{
+	auto n = static_cast<uint32_t>(state.range(0));
+	for(auto _ : state) {
+		state.PauseTiming();
+		panima::Animation anim;
+		auto &channel = generate_noisy_curve(anim, n);
+		state.ResumeTiming();
+		channel.Decimate();
+		benchmark::DoNotOptimize(channel.GetValueCount());
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_Decimate)->Range(256, 16 << 10);
+
+static void BM_ExpressionEvaluation(benchmark::State &state)
+{
+	panima::Animation anim;
+	auto &channel = generate_channel<float>(anim, "value", 1024);
+	std::string err;
+	if(!channel.SetValueExpression("value * 2 + sin(time)", err)) {
+		fail(state, err.c_str());
+		return;
+	}
+	auto duration = channel.GetMaxTime();
+	auto t = 0.f;
+	uint32_t pivot = 0;
+	for(auto _ : state) {
+		auto value = channel.GetInterpolatedValue<float>(t, pivot);
+		channel.ApplyValueExpression<float>(t, pivot, value);
+		benchmark::DoNotOptimize(value);
+		t += FRAME_TIME * 0.25f;
+		if(t > duration)
+			t = 0.f;
+	}
+}
+BENCHMARK(BM_ExpressionEvaluation);
+
+static void BM_AnimationSave(benchmark::State &state)
+{
+	auto anim = generate_animation(static_cast<uint32_t>(state.range(0)), 256);
+	for(auto _ : state) {
+		auto el = udm::Property::Create(udm::Type::Element);
+		udm::LinkedPropertyWrapper prop {*el};
+		benchmark::DoNotOptimize(anim->Save(prop));
+	}
+}
+BENCHMARK(BM_AnimationSave)->Range(8, 512);
+
+static void BM_AnimationLoad(benchmark::State &state)
+{
+	auto anim = generate_animation(static_cast<uint32_t>(state.range(0)), 256);
+	auto el = udm::Property::Create(udm::Type::Element);
+	udm::LinkedPropertyWrapper prop {*el};
+	anim->Save(prop);
+	for(auto _ : state) {
+		auto animLoaded = std::make_shared<panima::Animation>();
+		benchmark::DoNotOptimize(animLoaded->Load(prop));
+	}
+}
+BENCHMARK(BM_AnimationLoad)->Range(8, 512);
+
+static void BM_FindChannel(benchmark::State &state)
+{
+	auto numChannels = static_cast<uint32_t>(state.range(0));
+	auto anim = generate_animation(numChannels, 2);
+	std::vector<std::string> paths;
+	paths.reserve(numChannels);
+	for(auto &channel : anim->GetChannels())
+		paths.push_back(channel->targetPath.ToUri());
+	size_t i = 0;
+	for(auto _ : state)
+		benchmark::DoNotOptimize(anim->FindChannel(paths[i++ % paths.size()]));
+}
+BENCHMARK(BM_FindChannel)->Range(8, 512);
+
+// Pre-parsed paths skip the string interning
+static void BM_FindChannel_Path(benchmark::State &state)
+{
+	auto numChannels = static_cast<uint32_t>(state.range(0));
+	auto anim = generate_animation(numChannels, 2);
+	std::vector<panima::ChannelPath> paths;
+	paths.reserve(numChannels);
+	for(auto &channel : anim->GetChannels())
+		paths.push_back(channel->targetPath);
+	size_t i = 0;
+	for(auto _ : state)
+		benchmark::DoNotOptimize(anim->FindChannel(paths[i++ % paths.size()]));
+}
+BENCHMARK(BM_FindChannel_Path)->Range(8, 512);
+
+// Every thread samples all channels of the same frozen animation, no locks are involved
+static void BM_FrozenConcurrentSampling(benchmark::State &state)
+{
+	static auto frozen = generate_animation(64, 1024)->Freeze();
+	auto &channels = frozen->GetChannels();
+	std::vector<uint32_t> pivots(channels.size(), 0);
+	auto duration = frozen->GetDuration();
+	// Different start times per thread, so that the threads don't sample in lockstep
+	auto t = duration * static_cast<float>(state.thread_index()) / static_cast<float>(state.threads());
+	for(auto _ : state) {
+		for(auto i = decltype(channels.size()) {0u}; i < channels.size(); ++i) {
+			const panima::Channel &channel = *channels[i];
+			if((i % 2) == 0)
+				benchmark::DoNotOptimize(channel.GetInterpolatedValue<udm::Vector3>(t, pivots[i]));
+			else
+				benchmark::DoNotOptimize(channel.GetInterpolatedValue<udm::Quaternion>(t, pivots[i]));
+		}
+		t += FRAME_TIME * 0.25f;
+		if(t > duration)
+			t = 0.f;
+	}
+	state.SetItemsProcessed(state.iterations() * channels.size());
+}
+BENCHMARK(BM_FrozenConcurrentSampling)->ThreadRange(1, 8)->UseRealTime();
+
+// Advancing (including triggering events), sampling and submitting the pose must not allocate once all buffers have
+// been warmed up. Reported as an error if any allocation happens during the timed loop, or if no pose was submitted.
+static void BM_SteadyStatePlayback(benchmark::State &state)
+{
+	auto anim = generate_animation(static_cast<uint32_t>(state.range(0)), 256);
+	auto &exprChannel = generate_channel<float>(*anim, "expression", 256);
+	std::string err;
+	if(!exprChannel.SetValueExpression("value * 2 + sin(time)", err)) {
+		fail(state, err.c_str());
+		return;
+	}
+	// Several tracks with events at shared times, so that the events of multiple tracks have to be merged
+	for(auto trackIdx = 0u; trackIdx < 3u; ++trackIdx) {
+		auto *track = anim->AddEventTrack("track" + std::to_string(trackIdx));
+		for(auto i = 0u; i < 8u; ++i)
+			track->AddEvent(anim->GetDuration() * static_cast<float>(i) / 8.f, "event" + std::to_string(i));
+	}
+	anim->SetName("idle");
+	auto set = panima::AnimationSet::Create();
+	set->AddAnimation(*anim);
+	auto manager = panima::AnimationManager::Create();
+	manager->AddAnimationSet("default", *set);
+	uint64_t numChannelsSubmitted = 0;
+	manager->SetPoseSubmitter([&numChannelsSubmitted](const panima::Pose &pose) { numChannelsSubmitted += pose.changedChannels.size(); });
+	manager->PlayAnimation("idle");
+	if(!manager->GetCurrentAnimationHandle().IsValid()) {
+		fail(state, "Failed to play animation");
+		return;
+	}
+	// Without a callback interface, assigning the animation to the player is up to the caller
+	auto &player = manager->GetPlayer();
+	player.SetAnimation(*anim);
+	player.SetLooping(true);
+
+	constexpr auto dt = 1.f / 60.f;
+	uint64_t numFailedSubmits = 0;
+	uint64_t numMergedEventUpdates = 0;
+	auto update = [&]() {
+		player.Advance(dt);
+		if(player.GetTriggeredEvents().size() > 1)
+			++numMergedEventUpdates;
+		if(!manager->SubmitPose())
+			++numFailedSubmits;
+	};
+	// Warm-up: play the entire animation twice, so that every buffer has reached its final size
+	auto numWarmupUpdates = static_cast<uint32_t>(anim->GetDuration() / dt) * 2;
+	for(auto i = decltype(numWarmupUpdates) {0u}; i < numWarmupUpdates; ++i)
+		update();
+
+	auto allocationsStart = g_allocationCount.load();
+	for(auto _ : state)
+		update();
+	auto numAllocations = g_allocationCount.load() - allocationsStart;
+	state.counters["allocations"] = static_cast<double>(numAllocations);
+	benchmark::DoNotOptimize(numChannelsSubmitted);
+	if(numFailedSubmits > 0 || numChannelsSubmitted == 0)
+		fail(state, "Steady-state playback did not submit a pose");
+	else if(numMergedEventUpdates == 0)
+		fail(state, "Steady-state playback did not trigger events of multiple tracks");
+	else if(numAllocations > 0)
+		fail(state, "Steady-state playback performed heap allocations");
+}
+BENCHMARK(BM_SteadyStatePlayback)->Range(8, 512);
+
+int main(int argc, char **argv)
+{
+	benchmark::Initialize(&argc, argv);
+	if(benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return g_failed ? 1 : 0;
+}
@@ -3,66 +3,190 @@
 
 module;
 
+#include <cassert>
+
 module panima;
 
 import :animation;
 import :channel;
+import :instrumentation;
+
+panima::Channel *panima::Animation::AddChannel(std::string path, udm::Type valueType) { return AddChannel(ChannelPath {path}, valueType); }
 
-panima::Channel *panima::Animation::AddChannel(std::string path, udm::Type valueType)
+panima::Channel *panima::Animation::AddChannel(const ChannelPath &path, udm::Type valueType)
 {
-	ChannelPath channelPath {std::move(path)};
+	if(!CheckMutable())
+		return nullptr;
 	auto *channel = FindChannel(path);
 	if(channel)
-		return (channel->targetPath == channelPath && channel->GetValueType() == valueType) ? channel : nullptr;
+		return (channel->GetValueType() == valueType) ? channel : nullptr;
 	m_channels.push_back(std::make_shared<Channel>());
 	channel = m_channels.back().get();
 	channel->SetValueType(valueType);
 	channel->targetPath = path;
+	AddChannelToIndex(m_channels.size() - 1);
 	return channel;
 }
 
 void panima::Animation::RemoveChannel(std::string path)
 {
-	auto it = FindChannelIt(std::move(path));
-	if(it == m_channels.end())
+	if(!CheckMutable())
 		return;
-	m_channels.erase(it);
+	auto idx = FindChannelIndex(ChannelPath {path});
+	if(!idx)
+		return;
+	m_channels.erase(m_channels.begin() + *idx);
+	UpdateChannelIndex();
 }
 
 void panima::Animation::RemoveChannel(const Channel &channel)
 {
+	if(!CheckMutable())
+		return;
 	auto it = std::find_if(m_channels.begin(), m_channels.end(), [&channel](const std::shared_ptr<Channel> &channelOther) { return &channel == channelOther.get(); });
 	if(it == m_channels.end())
 		return;
 	m_channels.erase(it);
+	UpdateChannelIndex();
 }
 
 void panima::Animation::AddChannel(Channel &channel)
 {
-	auto it = std::find_if(m_channels.begin(), m_channels.end(), [&channel](const std::shared_ptr<Channel> &channelOther) { return channelOther->targetPath == channel.targetPath; });
-	if(it != m_channels.end()) {
-		*it = channel.shared_from_this();
+	if(!CheckMutable())
+		return;
+	auto idx = FindChannelIndex(channel.targetPath);
+	if(idx) {
+		m_channels[*idx] = channel.shared_from_this();
+		m_revision = get_next_revision();
 		return;
 	}
 	m_channels.push_back(channel.shared_from_this());
+	AddChannelToIndex(m_channels.size() - 1);
 }
 
-std::vector<std::shared_ptr<panima::Channel>>::iterator panima::Animation::FindChannelIt(std::string path)
+void panima::Animation::AddChannelToIndex(uint32_t idx)
 {
-	ChannelPath channelPath {std::move(path)};
-	return std::find_if(m_channels.begin(), m_channels.end(), [&channelPath](const std::shared_ptr<Channel> &channel) { return channel->targetPath == channelPath; });
+	m_channelIndex.insert({m_channels[idx]->targetPath.GetId(), idx});
+	m_channelIndexSize = m_channels.size();
+	m_revision = get_next_revision();
 }
 
-panima::Channel *panima::Animation::FindChannel(std::string path)
+void panima::Animation::UpdateChannelIndex()
 {
-	auto it = FindChannelIt(std::move(path));
-	if(it == m_channels.end())
+	if(!CheckMutable())
+		return;
+	m_channelIndex.clear();
+	m_channelIndex.reserve(m_channels.size());
+	for(auto i = decltype(m_channels.size()) {0u}; i < m_channels.size(); ++i)
+		m_channelIndex.insert({m_channels[i]->targetPath.GetId(), static_cast<uint32_t>(i)});
+	m_channelIndexSize = m_channels.size();
+	m_revision = get_next_revision();
+}
+
+panima::MemoryUsage panima::Animation::GetMemoryUsage() const
+{
+	MemoryUsage usage {};
+	usage.objects += sizeof(*this) + m_name.capacity() + m_channels.capacity() * sizeof(m_channels.front());
+	for(auto &channel : m_channels)
+		usage += channel->GetMemoryUsage();
+	usage.caches += get_hash_map_memory_usage(m_channelIndex);
+	usage.events += m_eventTracks.capacity() * sizeof(EventTrack);
+	for(auto &track : m_eventTracks)
+		usage.events += track.GetMemoryUsage();
+	if(m_rootMotion)
+		usage.rootMotion += sizeof(RootMotion) + m_rootMotion->poses.capacity() * sizeof(pragma::math::Transform);
+	return usage;
+}
+
+uint64_t panima::Animation::GetRevision() const
+{
+	// Revisions are strictly increasing, so the maximum changes whenever anything is modified
+	auto revision = m_revision;
+	for(auto &channel : m_channels)
+		revision = pragma::math::max(revision, channel->GetRevision());
+	return revision;
+}
+
+std::optional<uint32_t> panima::Animation::FindChannelIndex(const ChannelPath &path)
+{
+	// The channel list can be modified through GetChannels(), in which case the index is out of date
+	if(m_channelIndexSize != m_channels.size())
+		UpdateChannelIndex();
+	auto it = m_channelIndex.find(path.GetId());
+	if(it == m_channelIndex.end()) {
+		// The target path of a channel may have been changed directly, in which case it isn't in the index yet
+		auto itChannel = std::find_if(m_channels.begin(), m_channels.end(), [&path](const std::shared_ptr<Channel> &channel) { return channel->targetPath == path; });
+		if(itChannel == m_channels.end())
+			return {};
+		UpdateChannelIndex();
+		return static_cast<uint32_t>(itChannel - m_channels.begin());
+	}
+	auto idx = it->second;
+	if(idx >= m_channels.size() || m_channels[idx]->targetPath != path) {
+		// A channel was replaced through GetChannels()
+		UpdateChannelIndex();
+		it = m_channelIndex.find(path.GetId());
+		if(it == m_channelIndex.end())
+			return {};
+		idx = it->second;
+	}
+	return idx;
+}
+
+panima::Channel *panima::Animation::FindChannel(const ChannelPath &path)
+{
+	auto idx = FindChannelIndex(path);
+	if(!idx)
 		return nullptr;
-	return it->get();
+	return m_channels[*idx].get();
+}
+
+const panima::Channel *panima::Animation::FindChannel(const ChannelPath &path) const
+{
+	if(m_frozen) {
+		// Frozen animations can't be modified, so the index doesn't have to be validated (which may rebuild it)
+		auto it = m_channelIndex.find(path.GetId());
+		return (it != m_channelIndex.end()) ? m_channels[it->second].get() : nullptr;
+	}
+	return const_cast<Animation *>(this)->FindChannel(path);
+}
+
+panima::Channel *panima::Animation::FindChannel(std::string path) { return FindChannel(ChannelPath {path}); }
+
+bool panima::Animation::CheckMutable() const
+{
+	// Frozen animations may be sampled by multiple threads at once
+	assert(!m_frozen && "Frozen animations must not be modified");
+	return !m_frozen;
+}
+
+std::shared_ptr<const panima::Animation> panima::Animation::Freeze() const
+{
+	auto frozen = std::make_shared<Animation>();
+	frozen->m_channels.reserve(m_channels.size());
+	for(auto &channel : m_channels)
+		frozen->m_channels.push_back(std::const_pointer_cast<Channel>(channel->Freeze()));
+	frozen->UpdateChannelIndex();
+	frozen->m_eventTracks = m_eventTracks;
+	// Root motion is immutable and can be shared
+	frozen->m_rootMotion = m_rootMotion;
+	frozen->m_rootMotionSource = m_rootMotionSource;
+	frozen->m_name = m_name;
+	frozen->m_speedFactor = m_speedFactor;
+	frozen->m_duration = m_duration;
+	frozen->m_flags = m_flags;
+	if(m_rootMotion && GetRootMotion() == nullptr)
+		frozen->ClearRootMotion(); // Stale root motion isn't carried over
+	else if(frozen->m_rootMotionSource)
+		frozen->UpdateRootMotionSource();
+	frozen->m_frozen = true;
+	return frozen;
 }
 
 void panima::Animation::Merge(const Animation &other)
 {
+	if(!CheckMutable())
+		return;
 	for(auto &channelOther : other.GetChannels()) {
 		auto *channel = FindChannel(channelOther->targetPath);
 		if(!channel)
@@ -71,14 +195,319 @@ void panima::Animation::Merge(const Animation &other)
 			continue;
 		channel->MergeValues(*channelOther);
 	}
+	for(auto &trackOther : other.GetEventTracks()) {
+		auto *track = AddEventTrack(trackOther.GetName());
+		for(auto &ev : trackOther.GetEvents())
+			track->AddEvent(ev.time, ev.name, ev.arguments);
+	}
+}
+
+panima::EventTrack *panima::Animation::AddEventTrack(std::string name)
+{
+	if(!CheckMutable())
+		return nullptr;
+	auto *track = FindEventTrack(name);
+	if(track)
+		return track;
+	m_eventTracks.push_back(EventTrack {std::move(name)});
+	return &m_eventTracks.back();
+}
+
+void panima::Animation::RemoveEventTrack(const std::string_view &name)
+{
+	if(!CheckMutable())
+		return;
+	auto it = std::find_if(m_eventTracks.begin(), m_eventTracks.end(), [&name](const EventTrack &track) { return track.GetName() == name; });
+	if(it == m_eventTracks.end())
+		return;
+	m_eventTracks.erase(it);
+}
+
+panima::EventTrack *panima::Animation::FindEventTrack(const std::string_view &name)
+{
+	// The returned track could be modified
+	if(!CheckMutable())
+		return nullptr;
+	return const_cast<EventTrack *>(const_cast<const Animation *>(this)->FindEventTrack(name));
+}
+
+const panima::EventTrack *panima::Animation::FindEventTrack(const std::string_view &name) const
+{
+	auto it = std::find_if(m_eventTracks.begin(), m_eventTracks.end(), [&name](const EventTrack &track) { return track.GetName() == name; });
+	if(it == m_eventTracks.end())
+		return nullptr;
+	return &*it;
+}
+
+uint32_t panima::EventTrack::AddEvent(float time, std::string name, std::vector<std::string> arguments)
+{
+	// Events with the same time retain their insertion order
+	auto it = std::upper_bound(m_events.begin(), m_events.end(), time, [](float t, const AnimationEvent &ev) { return t < ev.time; });
+	it = m_events.insert(it, AnimationEvent {time, std::move(name), std::move(arguments)});
+	return it - m_events.begin();
+}
+
+void panima::EventTrack::RemoveEvent(uint32_t idx)
+{
+	if(idx >= m_events.size())
+		return;
+	m_events.erase(m_events.begin() + idx);
+}
+
+std::pair<uint32_t, uint32_t> panima::EventTrack::FindEvents(float tStart, float tEnd, bool includeStart, bool includeEnd) const
+{
+	auto lessTime = [](const AnimationEvent &ev, float t) { return ev.time < t; };
+	auto greaterTime = [](float t, const AnimationEvent &ev) { return t < ev.time; };
+	auto itStart = includeStart ? std::lower_bound(m_events.begin(), m_events.end(), tStart, lessTime) : std::upper_bound(m_events.begin(), m_events.end(), tStart, greaterTime);
+	auto itEnd = includeEnd ? std::upper_bound(itStart, m_events.end(), tEnd, greaterTime) : std::lower_bound(itStart, m_events.end(), tEnd, lessTime);
+	return {static_cast<uint32_t>(itStart - m_events.begin()), static_cast<uint32_t>(itEnd - m_events.begin())};
+}
+
+size_t panima::EventTrack::GetMemoryUsage() const
+{
+	auto size = m_name.capacity() + m_events.capacity() * sizeof(AnimationEvent);
+	for(auto &ev : m_events) {
+		size += ev.name.capacity() + ev.arguments.capacity() * sizeof(std::string);
+		for(auto &arg : ev.arguments)
+			size += arg.capacity();
+	}
+	return size;
+}
+
+bool panima::EventTrack::Save(udm::LinkedPropertyWrapper &prop) const
+{
+	prop["name"] = m_name;
+	auto udmEvents = prop.AddArray("events", m_events.size());
+	for(auto i = decltype(m_events.size()) {0u}; i < m_events.size(); ++i) {
+		auto &ev = m_events[i];
+		auto udmEvent = udmEvents[i];
+		udmEvent["time"] = ev.time;
+		udmEvent["name"] = ev.name;
+		if(!ev.arguments.empty())
+			udmEvent["arguments"] = ev.arguments;
+	}
+	return true;
+}
+
+bool panima::EventTrack::Load(udm::LinkedPropertyWrapper &prop)
+{
+	prop["name"](m_name);
+	m_events.clear();
+	for(auto udmEvent : prop["events"]) {
+		AnimationEvent ev {};
+		udmEvent["time"](ev.time);
+		udmEvent["name"](ev.name);
+		udmEvent["arguments"](ev.arguments);
+		AddEvent(ev.time, std::move(ev.name), std::move(ev.arguments));
+	}
+	return true;
 }
 
-bool panima::Animation::Save(udm::LinkedPropertyWrapper &prop) const
+uint32_t panima::Animation::BakeValueExpressions(const Channel::ExpressionBakeInfo &bakeInfo)
 {
-	auto udmChannels = prop.AddArray("channels", m_channels.size());
-	for(auto i = decltype(m_channels.size()) {0u}; i < m_channels.size(); ++i) {
-		auto udmChannel = udmChannels[i];
-		m_channels[i]->Save(udmChannel);
+	if(!CheckMutable())
+		return 0;
+	auto channelBakeInfo = bakeInfo;
+	if(!channelBakeInfo.timeRange && m_duration > 0.f)
+		channelBakeInfo.timeRange = std::pair<float, float> {0.f, m_duration};
+	uint32_t numBaked = 0;
+	for(auto &channel : m_channels) {
+		if(!channel->GetValueExpression())
+			continue;
+		if(channel->BakeValueExpression(channelBakeInfo))
+			++numBaked;
+	}
+	return numBaked;
+}
+
+bool panima::Animation::ComputeRootMotion(const ChannelPath &positionPath, const ChannelPath &rotationPath, float sampleRate)
+{
+	if(!CheckMutable())
+		return false;
+	auto *posChannel = FindChannel(positionPath);
+	auto *rotChannel = FindChannel(rotationPath);
+	if(posChannel && posChannel->GetValueType() != udm::Type::Vector3)
+		posChannel = nullptr;
+	if(rotChannel && rotChannel->GetValueType() != udm::Type::Quaternion)
+		rotChannel = nullptr;
+	if((!posChannel && !rotChannel) || sampleRate <= 0.f) {
+		ClearRootMotion();
+		return false;
+	}
+	auto rootMotion = std::make_shared<RootMotion>();
+	rootMotion->sampleRate = sampleRate;
+	rootMotion->duration = m_duration;
+	auto numSamples = static_cast<uint32_t>(std::ceil(m_duration * sampleRate)) + 1;
+	rootMotion->poses.reserve(numSamples);
+	uint32_t posPivot = 0;
+	uint32_t rotPivot = 0;
+	for(auto i = decltype(numSamples) {0u}; i < numSamples; ++i) {
+		auto t = pragma::math::min(static_cast<float>(i) / sampleRate, m_duration);
+		Vector3 pos {};
+		auto rot = uquat::identity();
+		if(posChannel) {
+			pos = posChannel->GetInterpolatedValue<Vector3>(t, posPivot);
+			posChannel->ApplyValueExpression<Vector3>(t, posPivot, pos);
+		}
+		if(rotChannel) {
+			rot = rotChannel->GetInterpolatedValue<Quat>(t, rotPivot);
+			rotChannel->ApplyValueExpression<Quat>(t, rotPivot, rot);
+		}
+		rootMotion->poses.push_back(pragma::math::Transform {pos, rot});
+	}
+	m_rootMotion = std::move(rootMotion);
+	RootMotionSource source {positionPath, rotationPath, sampleRate};
+	m_rootMotionSource = std::move(source);
+	UpdateRootMotionSource();
+	return true;
+}
+
+void panima::Animation::UpdateRootMotionSource()
+{
+	auto &source = *m_rootMotionSource;
+	source.positionChannel = FindChannel(source.positionPath);
+	source.rotationChannel = FindChannel(source.rotationPath);
+	source.positionRevision = source.positionChannel ? source.positionChannel->GetRevision() : 0;
+	source.rotationRevision = source.rotationChannel ? source.rotationChannel->GetRevision() : 0;
+	// Has to be read after the lookups, which may rebuild the channel index
+	source.animationRevision = m_revision;
+}
+
+bool panima::Animation::UpdateRootMotion()
+{
+	if(!CheckMutable())
+		return false;
+	if(!m_rootMotionSource)
+		return false;
+	auto source = *m_rootMotionSource;
+	return ComputeRootMotion(source.positionPath, source.rotationPath, source.sampleRate);
+}
+
+void panima::Animation::ClearRootMotion()
+{
+	if(!CheckMutable())
+		return;
+	m_rootMotion = nullptr;
+	m_rootMotionSource = {};
+}
+
+const panima::RootMotion *panima::Animation::GetRootMotion() const
+{
+	if(!m_rootMotion)
+		return nullptr;
+	// The channel pointers are only dereferenced if no channels were added or removed since
+	auto &source = *m_rootMotionSource;
+	if(source.animationRevision != m_revision || m_rootMotion->duration != m_duration)
+		return nullptr;
+	if((source.positionChannel && source.positionChannel->GetRevision() != source.positionRevision) || (source.rotationChannel && source.rotationChannel->GetRevision() != source.rotationRevision))
+		return nullptr;
+	return m_rootMotion.get();
+}
+
+void panima::Animation::SetDuration(float duration)
+{
+	if(!CheckMutable())
+		return;
+	if(duration == m_duration)
+		return;
+	m_duration = duration;
+	if(m_rootMotion)
+		UpdateRootMotion();
+}
+
+pragma::math::Transform panima::RootMotion::GetPose(float t) const
+{
+	if(poses.empty())
+		return {};
+	t = pragma::math::clamp(t, 0.f, duration);
+	auto idx = pragma::math::min(static_cast<size_t>(t * sampleRate), poses.size() - 1);
+	if(idx == poses.size() - 1)
+		return poses.back();
+	// The last interval may be shorter than the sample interval
+	auto t0 = static_cast<float>(idx) / sampleRate;
+	auto t1 = pragma::math::min(static_cast<float>(idx + 1) / sampleRate, duration);
+	auto f = (t1 > t0) ? ((t - t0) / (t1 - t0)) : 0.f;
+	auto &pose0 = poses[idx];
+	auto &pose1 = poses[idx + 1];
+	return pragma::math::Transform {uvec::lerp(pose0.GetOrigin(), pose1.GetOrigin(), f), uquat::slerp(pose0.GetRotation(), pose1.GetRotation(), f)};
+}
+
+pragma::math::Transform panima::RootMotion::GetDelta(float tStart, float tEnd) const { return GetPose(tStart).GetInverse() * GetPose(tEnd); }
+
+bool panima::Animation::Save(udm::LinkedPropertyWrapper &prop) const { return Save(prop, SaveOptions {.threadCount = 1, .batchSize = std::numeric_limits<uint32_t>::max()}); }
+bool panima::Animation::Save(udm::LinkedPropertyWrapper &prop, const SaveOptions &options) const
+{
+	instrumentation::ScopedTimer timer {instrumentation::Timer::AnimationSave};
+	auto numChannels = static_cast<uint32_t>(m_channels.size());
+	auto numThreads = (options.threadCount > 0) ? options.threadCount : pragma::math::max(std::thread::hardware_concurrency(), 1u);
+	auto batchSize = pragma::math::max(options.batchSize, 1u);
+	auto udmChannels = prop.AddArray("channels", numChannels);
+	if(numThreads == 1) {
+		for(auto i = decltype(numChannels) {0u}; i < numChannels; ++i) {
+			auto udmChannel = udmChannels[i];
+			m_channels[i]->Save(udmChannel);
+			if(options.progressCallback && ((i + 1) % batchSize == 0 || i + 1 == numChannels))
+				options.progressCallback(i + 1, numChannels);
+		}
+	}
+	else {
+		// Each channel is serialized into a detached element by one of the workers, which is where the arrays are
+		// compressed. The elements are then moved into the output in order on the calling thread.
+		std::vector<udm::PProperty> batch;
+		for(auto batchStart = decltype(numChannels) {0u}; batchStart < numChannels;) {
+			auto n = pragma::math::min(batchSize, numChannels - batchStart);
+			batch.assign(n, nullptr);
+			std::atomic<uint32_t> nextIndex = 0;
+			// An exception must not escape a worker thread, the first one is rethrown on the calling thread instead
+			std::mutex errorMutex;
+			std::exception_ptr error = nullptr;
+			auto worker = [this, &batch, &nextIndex, &errorMutex, &error, batchStart, n]() {
+				for(;;) {
+					auto i = nextIndex.fetch_add(1, std::memory_order_relaxed);
+					if(i >= n)
+						break;
+					try {
+						auto el = udm::Property::Create(udm::Type::Element);
+						udm::LinkedPropertyWrapper udmChannel {*el};
+						m_channels[batchStart + i]->Save(udmChannel);
+						batch[i] = std::move(el);
+					}
+					catch(...) {
+						std::scoped_lock lock {errorMutex};
+						if(!error)
+							error = std::current_exception();
+						// Stop the remaining workers, the result is discarded anyway
+						nextIndex.store(n, std::memory_order_relaxed);
+						break;
+					}
+				}
+			};
+			{
+				auto numWorkers = pragma::math::min(numThreads, n);
+				std::vector<std::jthread> threads;
+				threads.reserve(numWorkers - 1);
+				for(auto i = decltype(numWorkers) {1u}; i < numWorkers; ++i)
+					threads.emplace_back(worker);
+				worker();
+			}
+			// All workers have been joined at this point
+			if(error)
+				std::rethrow_exception(error);
+			for(auto i = decltype(n) {0u}; i < n; ++i) {
+				udmChannels[batchStart + i] = batch[i];
+				batch[i] = nullptr;
+			}
+			batchStart += n;
+			if(options.progressCallback)
+				options.progressCallback(batchStart, numChannels);
+		}
+	}
+	if(!m_eventTracks.empty()) {
+		auto udmEventTracks = prop.AddArray("eventTracks", m_eventTracks.size());
+		for(auto i = decltype(m_eventTracks.size()) {0u}; i < m_eventTracks.size(); ++i) {
+			auto udmEventTrack = udmEventTracks[i];
+			m_eventTracks[i].Save(udmEventTrack);
+		}
 	}
 
 	prop["speedFactor"] = m_speedFactor;
@@ -86,14 +515,26 @@ bool panima::Animation::Save(udm::LinkedPropertyWrapper &prop) const
 	prop["flags"] = udm::flags_to_string(m_flags);
 	return true;
 }
-bool panima::Animation::Load(udm::LinkedPropertyWrapper &prop)
+bool panima::Animation::Load(udm::LinkedPropertyWrapper &prop, bool deferChannelData)
 {
+	if(!CheckMutable())
+		return false;
+	instrumentation::ScopedTimer timer {instrumentation::Timer::AnimationLoad};
 	auto udmChannels = prop["channels"];
 	auto numChannels = udmChannels.GetSize();
 	m_channels.reserve(numChannels);
 	for(auto udmChannel : udmChannels) {
 		m_channels.push_back(std::make_shared<Channel>());
-		m_channels.back()->Load(udmChannel);
+		m_channels.back()->Load(udmChannel, deferChannelData);
+	}
+	UpdateChannelIndex();
+
+	auto udmEventTracks = prop["eventTracks"];
+	m_eventTracks.clear();
+	m_eventTracks.reserve(udmEventTracks.GetSize());
+	for(auto udmEventTrack : udmEventTracks) {
+		m_eventTracks.push_back({});
+		m_eventTracks.back().Load(udmEventTrack);
 	}
 
 	prop["speedFactor"](m_speedFactor);
@@ -9,25 +9,29 @@ import :animation_manager;
 import :animation_set;
 import :animation;
 import :player;
+import :channel;
+import :slice;
+import :pose_cache;
+import :instrumentation;
 
 std::shared_ptr<panima::AnimationManager> panima::AnimationManager::Create(const AnimationManager &other) { return std::shared_ptr<AnimationManager> {new AnimationManager {other}}; }
 std::shared_ptr<panima::AnimationManager> panima::AnimationManager::Create(AnimationManager &&other) { return std::shared_ptr<AnimationManager> {new AnimationManager {std::move(other)}}; }
 std::shared_ptr<panima::AnimationManager> panima::AnimationManager::Create() { return std::shared_ptr<AnimationManager> {new AnimationManager {}}; }
 panima::AnimationManager::AnimationManager(const AnimationManager &other)
-    : m_player {Player::Create(*other.m_player)}, m_animationSets {other.m_animationSets}, m_currentAnimation {other.m_currentAnimation}, m_setNameToIndex {other.m_setNameToIndex}, m_currentAnimationSet {other.m_currentAnimationSet}, m_prevAnimSlice {other.m_prevAnimSlice},
+    : m_player {Player::Create(*other.m_player)}, m_animationSets {other.m_animationSets}, m_currentAnimation {other.m_currentAnimation}, m_currentAnimationGeneration {other.m_currentAnimationGeneration}, m_setNameToIndex {other.m_setNameToIndex}, m_currentAnimationSet {other.m_currentAnimationSet}, m_prevAnimSlice {other.m_prevAnimSlice},
       m_priority {other.m_priority}
 /*,m_channelValueSubmitters{m_channelValueSubmitters}*/
 {
 #ifdef _MSC_VER
-	static_assert(sizeof(*this) == 392, "Update this implementation when class has changed!");
+	static_assert(sizeof(*this) == 688, "Update this implementation when class has changed!");
 #endif
 }
 panima::AnimationManager::AnimationManager(AnimationManager &&other)
-    : m_player {Player::Create(*other.m_player)}, m_animationSets {std::move(other.m_animationSets)}, m_currentAnimation {other.m_currentAnimation}, m_setNameToIndex {std::move(other.m_setNameToIndex)}, m_currentAnimationSet {other.m_currentAnimationSet},
+    : m_player {Player::Create(*other.m_player)}, m_animationSets {std::move(other.m_animationSets)}, m_currentAnimation {other.m_currentAnimation}, m_currentAnimationGeneration {other.m_currentAnimationGeneration}, m_setNameToIndex {std::move(other.m_setNameToIndex)}, m_currentAnimationSet {other.m_currentAnimationSet},
       m_prevAnimSlice {std::move(other.m_prevAnimSlice)}, m_priority {other.m_priority} /*,m_channelValueSubmitters{std::move(m_channelValueSubmitters)}*/
 {
 #ifdef _MSC_VER
-	static_assert(sizeof(*this) == 392, "Update this implementation when class has changed!");
+	static_assert(sizeof(*this) == 688, "Update this implementation when class has changed!");
 #endif
 }
 panima::AnimationManager::AnimationManager() : m_player {Player::Create()} {}
@@ -36,14 +40,16 @@ panima::AnimationManager &panima::AnimationManager::operator=(const AnimationMan
 	m_player = Player::Create(*other.m_player);
 	m_animationSets = other.m_animationSets;
 	m_currentAnimation = other.m_currentAnimation;
+	m_currentAnimationGeneration = other.m_currentAnimationGeneration;
 	m_currentAnimationSet = other.m_currentAnimationSet;
 	m_setNameToIndex = other.m_setNameToIndex;
+	m_animationNameIndex.dirty = true;
 
 	m_prevAnimSlice = other.m_prevAnimSlice;
 	m_priority = other.m_priority;
 	// m_channelValueSubmitters = other.m_channelValueSubmitters;
 #ifdef _MSC_VER
-	static_assert(sizeof(*this) == 392, "Update this implementation when class has changed!");
+	static_assert(sizeof(*this) == 688, "Update this implementation when class has changed!");
 #endif
 	return *this;
 }
@@ -52,15 +58,17 @@ panima::AnimationManager &panima::AnimationManager::operator=(AnimationManager &
 	m_player = Player::Create(*other.m_player);
 	m_animationSets = std::move(other.m_animationSets);
 	m_currentAnimation = other.m_currentAnimation;
+	m_currentAnimationGeneration = other.m_currentAnimationGeneration;
 	m_currentAnimationSet = other.m_currentAnimationSet;
 	m_setNameToIndex = std::move(other.m_setNameToIndex);
+	m_animationNameIndex.dirty = true;
 
 	m_prevAnimSlice = std::move(other.m_prevAnimSlice);
 	m_priority = other.m_priority;
 	// m_channelValueSubmitters = std::move(other.m_channelValueSubmitters);
 
 #ifdef _MSC_VER
-	static_assert(sizeof(*this) == 392, "Update this implementation when class has changed!");
+	static_assert(sizeof(*this) == 688, "Update this implementation when class has changed!");
 #endif
 	return *this;
 }
@@ -78,12 +86,110 @@ void panima::AnimationManager::RemoveAnimationSet(const std::string_view &name)
 		StopAnimation();
 	m_animationSets.erase(m_animationSets.begin() + idx);
 	m_setNameToIndex.erase(it);
+	for(auto &pair : m_setNameToIndex) {
+		if(pair.second > idx)
+			--pair.second;
+	}
+	m_animationNameIndex.dirty = true;
 }
 void panima::AnimationManager::AddAnimationSet(std::string name, AnimationSet &animSet)
 {
 	RemoveAnimationSet(name);
 	m_animationSets.push_back(animSet.shared_from_this());
 	m_setNameToIndex[name] = m_animationSets.size() - 1;
+	m_animationNameIndex.dirty = true;
+}
+
+void panima::AnimationManager::UpdateAnimationNameIndex() const
+{
+	auto &index = m_animationNameIndex;
+	if(!index.dirty) {
+		for(auto i = decltype(m_animationSets.size()) {0u}; i < m_animationSets.size(); ++i) {
+			if(m_animationSets[i]->GetRevision() != index.setRevisions[i]) {
+				index.dirty = true;
+				break;
+			}
+		}
+		if(!index.dirty)
+			return;
+	}
+	index.nameToAnimation.clear();
+	index.setRevisions.resize(m_animationSets.size());
+	for(auto i = decltype(m_animationSets.size()) {0u}; i < m_animationSets.size(); ++i) {
+		// The sets may be modified on another thread, so the index is built from a consistent snapshot of each set
+		auto snapshot = m_animationSets[i]->GetSnapshot();
+		index.setRevisions[i] = snapshot->GetRevision();
+		auto &anims = snapshot->GetAnimations();
+		for(auto id = decltype(anims.size()) {0u}; id < anims.size(); ++id) {
+			auto &anim = anims[id];
+			if(!anim)
+				continue;
+			auto &name = anim->GetName();
+			// The animation may have been renamed after it was added to the set
+			if(snapshot->LookupAnimation(name) != static_cast<AnimationId>(id))
+				continue;
+			// Earlier sets take precedence
+			index.nameToAnimation.insert({name, AnimationReference {static_cast<AnimationSetIndex>(i), static_cast<AnimationId>(id)}});
+		}
+	}
+	index.dirty = false;
+}
+
+panima::AnimationManager::AnimationHandle panima::AnimationManager::ResolveAnimation(const std::string &animation) const
+{
+	UpdateAnimationNameIndex();
+	auto it = m_animationNameIndex.nameToAnimation.find(animation);
+	if(it == m_animationNameIndex.nameToAnimation.end())
+		return {};
+	auto [setIdx, animId] = it->second;
+	auto snapshot = m_animationSets[setIdx]->GetSnapshot();
+	// The set may have been modified since the index was built
+	if(snapshot->LookupAnimation(animation) != animId)
+		return {};
+	return {m_animationSets[setIdx], setIdx, animId, snapshot->GetGeneration(animId)};
+}
+
+panima::AnimationManager::AnimationHandle panima::AnimationManager::ResolveAnimation(const std::string &setName, const std::string &animation) const
+{
+	auto setIdx = FindAnimationSetIndex(setName);
+	if(!setIdx.has_value())
+		return {};
+	auto snapshot = m_animationSets[*setIdx]->GetSnapshot();
+	auto animId = snapshot->LookupAnimation(animation);
+	if(!animId.has_value())
+		return {};
+	return {m_animationSets[*setIdx], *setIdx, *animId, snapshot->GetGeneration(*animId)};
+}
+
+void panima::AnimationManager::PlayAnimation(const AnimationHandle &handle, PlaybackFlags flags)
+{
+	auto set = handle.animationSet.lock();
+	if(!set || !handle.IsValid()) {
+		StopAnimation();
+		return;
+	}
+	auto snapshot = set->GetSnapshot();
+	if(!snapshot->GetAnimation(handle.animation) || snapshot->GetGeneration(handle.animation) != handle.generation) {
+		// The animation was removed, and its id may have been reused by another animation
+		StopAnimation();
+		return;
+	}
+	auto setIdx = handle.animationSetIndex;
+	if(setIdx >= m_animationSets.size() || m_animationSets[setIdx] != set) {
+		// The set indices have changed since the handle was resolved
+		auto it = std::find(m_animationSets.begin(), m_animationSets.end(), set);
+		if(it == m_animationSets.end()) {
+			StopAnimation();
+			return;
+		}
+		setIdx = it - m_animationSets.begin();
+	}
+	auto p = FindAnimation(setIdx, handle.animation, flags);
+	if(p.first == INVALID_ANIMATION_SET_INDEX) {
+		StopAnimation();
+		return;
+	}
+	PlayAnimation(p.first, p.second, flags);
 }
 
 void panima::AnimationManager::PlayAnimation(const std::string &animation, PlaybackFlags flags)
@@ -96,6 +202,16 @@ void panima::AnimationManager::PlayAnimation(const std::string &animation, Playb
 	PlayAnimation(p.first, p.second, flags);
 }
 
+panima::AnimationManager::AnimationHandle panima::AnimationManager::GetCurrentAnimationHandle() const
+{
+	auto set = m_currentAnimationSet.lock();
+	if(!set || m_currentAnimation == INVALID_ANIMATION)
+		return {};
+	auto it = std::find(m_animationSets.begin(), m_animationSets.end(), set);
+	auto setIdx = (it != m_animationSets.end()) ? static_cast<AnimationSetIndex>(it - m_animationSets.begin()) : INVALID_ANIMATION_SET_INDEX;
+	return {set, setIdx, m_currentAnimation, m_currentAnimationGeneration};
+}
+
 panima::AnimationSet *panima::AnimationManager::GetAnimationSet(AnimationSetIndex idx)
 {
 	if(idx >= m_animationSets.size())
@@ -117,7 +233,7 @@ panima::AnimationManager::AnimationReference panima::AnimationManager::FindAnima
 	if(!set)
 		return INVALID_ANIMATION_REFERENCE;
 	if(m_callbackInterface.translateAnimation)
-		m_callbackInterface.translateAnimation(*set, animation, flags);
+		m_callbackInterface.translateAnimation(*set->GetSnapshot(), animation, flags);
 	return {animSetIndex, animation};
 }
 panima::AnimationManager::AnimationReference panima::AnimationManager::FindAnimation(AnimationSetIndex animSetIndex, const std::string &animation, PlaybackFlags flags) const
@@ -125,7 +241,7 @@ panima::AnimationManager::AnimationReference panima::AnimationManager::FindAnima
 	auto *set = GetAnimationSet(animSetIndex);
 	if(!set)
 		return INVALID_ANIMATION_REFERENCE;
-	auto id = set->LookupAnimation(animation);
+	auto id = set->GetSnapshot()->LookupAnimation(animation);
 	if(!id.has_value())
 		return INVALID_ANIMATION_REFERENCE;
 	return FindAnimation(animSetIndex, *id, flags);
@@ -153,14 +269,11 @@ panima::AnimationManager::AnimationReference panima::AnimationManager::FindAnima
 }
 panima::AnimationManager::AnimationReference panima::AnimationManager::FindAnimation(const std::string &animation, PlaybackFlags flags) const
 {
-	for(auto it = m_animationSets.begin(); it != m_animationSets.end(); ++it) {
-		auto &set = **it;
-		auto animId = set.LookupAnimation(animation);
-		if(!animId.has_value())
-			continue;
-		return FindAnimation(it - m_animationSets.begin(), *animId, flags);
-	}
-	return INVALID_ANIMATION_REFERENCE;
+	UpdateAnimationNameIndex();
+	auto it = m_animationNameIndex.nameToAnimation.find(animation);
+	if(it == m_animationNameIndex.nameToAnimation.end())
+		return INVALID_ANIMATION_REFERENCE;
+	return FindAnimation(it->second.first, it->second.second, flags);
 }
 
 void panima::AnimationManager::PlayAnimation(AnimationSetIndex animSetIndex, AnimationId animIdx, PlaybackFlags flags)
@@ -170,18 +283,23 @@ void panima::AnimationManager::PlayAnimation(AnimationSetIndex animSetIndex, Ani
 		return;
 	}
 	auto &set = m_animationSets[animSetIndex];
+	auto snapshot = set->GetSnapshot();
+	auto generation = snapshot->GetGeneration(animIdx);
 	auto reset = (flags & PlaybackFlags::ResetBit) != PlaybackFlags::None;
-	if(!reset && set.get() == m_currentAnimationSet.lock().get() && m_currentAnimation == animIdx) {
-		if(set->GetAnimation(animIdx)->HasFlags(Animation::Flags::LoopBit))
+	if(!reset && set.get() == m_currentAnimationSet.lock().get() && m_currentAnimation == animIdx && m_currentAnimationGeneration == generation) {
+		// The animation may have been removed from the set in the meantime
+		auto *anim = snapshot->GetAnimation(animIdx);
+		if(anim && anim->HasFlags(Animation::Flags::LoopBit))
 			return;
 	}
 
 	if(!reset && (*this)->GetCurrentTime() == 0.f && m_currentFlags == flags)
 		return;
-	if(m_callbackInterface.onPlayAnimation && m_callbackInterface.onPlayAnimation(*set, animIdx, flags) == false)
+	if(m_callbackInterface.onPlayAnimation && m_callbackInterface.onPlayAnimation(*snapshot, animIdx, flags) == false)
 		return;
 	m_currentAnimationSet = set;
 	m_currentAnimation = animIdx;
+	m_currentAnimationGeneration = generation;
 	(*this)->Reset();
 	m_currentFlags = flags;
 #ifdef PRAGMA_ENABLE_ANIMATION_SYSTEM_2
@@ -225,6 +343,251 @@ void panima::AnimationManager::StopAnimation()
 	(*this)->Reset();
 	m_currentFlags = PlaybackFlags::None;
 }
+void panima::AnimationManager::UpdatePoseLayout(const Animation &anim)
+{
+	m_poseAnimation = anim.shared_from_this();
+	auto &channels = anim.GetChannels();
+	m_pose.groups.clear();
+	m_pose.channelCount = channels.size();
+	for(auto i = decltype(channels.size()) {0u}; i < channels.size(); ++i) {
+		auto type = channels[i]->GetValueType();
+		if(!is_animatable_type(type))
+			continue;
+		auto it = std::find_if(m_pose.groups.begin(), m_pose.groups.end(), [type](const Pose::Group &group) { return group.type == type; });
+		if(it == m_pose.groups.end()) {
+			m_pose.groups.push_back({});
+			it = m_pose.groups.end() - 1;
+			it->type = type;
+		}
+		it->channelIds.push_back(static_cast<AnimationChannelId>(i));
+	}
+	m_poseLodGroups.clear();
+	m_poseLodGroups.resize(m_pose.groups.size());
+	for(auto i = decltype(m_pose.groups.size()) {0u}; i < m_pose.groups.size(); ++i) {
+		auto &group = m_pose.groups[i];
+		group.values.resize(group.channelIds.size() * udm::size_of_base_type(group.type));
+		m_poseLodGroups[i].sourceValues.resize(group.values.size());
+		m_poseLodGroups[i].targetValues.resize(group.values.size());
+	}
+	m_poseTimestampIndices.assign(channels.size(), std::numeric_limits<uint32_t>::max());
+	m_poseChannelRevisions.assign(channels.size(), 0);
+}
+
+bool panima::AnimationManager::SubmitPose()
+{
+	if(!m_poseSubmitter)
+		return false;
+	instrumentation::ScopedTimer timer {instrumentation::Timer::PoseSample};
+	auto *anim = m_player->GetAnimation();
+	if(!anim)
+		return false;
+	auto &player = *m_player;
+	auto &channels = anim->GetChannels();
+	auto fullUpdate = player.IsFullUpdate();
+	if(m_poseAnimation.get() != anim || m_pose.channelCount != channels.size()) {
+		UpdatePoseLayout(*anim);
+		fullUpdate = true;
+	}
+	auto &lod = player.GetLodPolicy();
+	auto lodInterpolate = (lod.updateInterval > 1 && lod.mode == Player::LodPolicy::Mode::Interpolate);
+	auto interpolate = lodInterpolate && !fullUpdate;
+	auto sample = fullUpdate || player.ShouldSample();
+	if(!sample && !interpolate)
+		return false; // The pose is held until the next sampled update
+	auto skipLowPriority = lod.skipLowPriorityChannels && !fullUpdate;
+	auto t = player.GetCurrentTime();
+	// Only complete samples can be cached, and only if they are reproducible
+	auto *poseCache = (m_poseCache && sample && !interpolate && !skipLowPriority) ? m_poseCache.get() : nullptr;
+	if(poseCache && std::any_of(channels.begin(), channels.end(), [](const std::shared_ptr<Channel> &channel) { return channel->IsValueExpressionImpure(); }))
+		poseCache = nullptr;
+	if(poseCache) {
+		t = poseCache->GetQuantizedTime(t);
+		if(auto *cachedPose = poseCache->Find(*anim, t)) {
+			CopyPoseValues(cachedPose->pose, fullUpdate);
+			// The pivots have to match the values for the unchanged-sample check to be valid
+			m_poseTimestampIndices = cachedPose->timestampIndices;
+			// Cached poses are only found for the current revision of the animation
+			for(auto i = decltype(channels.size()) {0u}; i < channels.size(); ++i)
+				m_poseChannelRevisions[i] = channels[i]->GetRevision();
+			if(lodInterpolate) {
+				for(auto groupIdx = decltype(m_pose.groups.size()) {0u}; groupIdx < m_pose.groups.size(); ++groupIdx) {
+					m_poseLodGroups[groupIdx].sourceValues = m_pose.groups[groupIdx].values;
+					m_poseLodGroups[groupIdx].targetValues = m_pose.groups[groupIdx].values;
+				}
+			}
+			m_poseSubmitter(m_pose);
+			return true;
+		}
+	}
+	auto f = static_cast<float>(player.GetLodUpdateIndex() + 1) / static_cast<float>(pragma::math::max(lod.updateInterval, 1u));
+	m_pose.changedChannels.clear();
+	for(auto groupIdx = decltype(m_pose.groups.size()) {0u}; groupIdx < m_pose.groups.size(); ++groupIdx) {
+		auto &group = m_pose.groups[groupIdx];
+		auto &lodGroup = m_poseLodGroups[groupIdx];
+		udm::visit_ng(group.type, [&](auto tag) {
+			using T = typename decltype(tag)::type;
+			if constexpr(is_animatable_type(udm::type_to_enum<T>())) {
+				auto values = group.GetValues<T>();
+				if(sample) {
+					auto *dst = values.data();
+					if(interpolate) {
+						// Blend from the current output towards the new sample
+						lodGroup.sourceValues = group.values;
+						dst = reinterpret_cast<T *>(lodGroup.targetValues.data());
+					}
+					for(auto i = decltype(values.size()) {0u}; i < values.size(); ++i) {
+						auto channelId = group.channelIds[i];
+						auto &channel = *channels[channelId];
+						if(skipLowPriority && channel.HasFlags(Channel::Flags::LowPriority))
+							continue;
+						auto &pivotTimeIndex = m_poseTimestampIndices[channelId];
+						auto &revision = m_poseChannelRevisions[channelId];
+						// The previous value is still valid if the channel has not changed since the last sample
+						if(!fullUpdate && revision == channel.GetRevision() && channel.IsSampleUnchanged(t, pivotTimeIndex)) {
+							instrumentation::increment(instrumentation::Counter::ChannelSampleSkipped);
+							continue;
+						}
+						revision = channel.GetRevision();
+						instrumentation::increment(instrumentation::Counter::ChannelSample);
+						dst[i] = channel.GetInterpolatedValue<T>(t, pivotTimeIndex);
+						if constexpr(is_supported_expression_type_v<T>) {
+							if(channel.GetValueExpression())
+								channel.ApplyValueExpression<T>(t, pivotTimeIndex, dst[i]);
+						}
+						if(!interpolate)
+							m_pose.changedChannels.push_back(channelId);
+					}
+					if(lodInterpolate && !interpolate) {
+						lodGroup.sourceValues = group.values;
+						lodGroup.targetValues = group.values;
+					}
+				}
+				if(interpolate && !values.empty()) {
+					auto *src = reinterpret_cast<const T *>(lodGroup.sourceValues.data());
+					auto *dst = reinterpret_cast<const T *>(lodGroup.targetValues.data());
+					auto interp = channels[group.channelIds.front()]->template GetInterpolationFunction<T>();
+					for(auto i = decltype(values.size()) {0u}; i < values.size(); ++i) {
+						if(memcmp(&src[i], &dst[i], sizeof(T)) == 0)
+							continue;
+						values[i] = interp(src[i], dst[i], f);
+						m_pose.changedChannels.push_back(group.channelIds[i]);
+					}
+				}
+			}
+		});
+	}
+	if(poseCache)
+		poseCache->Insert(*anim, t, m_pose, m_poseTimestampIndices);
+	m_poseSubmitter(m_pose);
+	return true;
+}
+
+void panima::AnimationManager::CopyPoseValues(const Pose &src, bool fullUpdate)
+{
+	// Both poses have the same layout, since the layout only depends on the animation
+	m_pose.changedChannels.clear();
+	for(auto groupIdx = decltype(m_pose.groups.size()) {0u}; groupIdx < m_pose.groups.size(); ++groupIdx) {
+		auto &group = m_pose.groups[groupIdx];
+		auto &srcGroup = src.groups[groupIdx];
+		auto valueSize = udm::size_of_base_type(group.type);
+		for(auto i = decltype(group.channelIds.size()) {0u}; i < group.channelIds.size(); ++i) {
+			auto *dstValue = group.values.data() + i * valueSize;
+			auto *srcValue = srcGroup.values.data() + i * valueSize;
+			if(!fullUpdate && memcmp(dstValue, srcValue, valueSize) == 0)
+				continue;
+			memcpy(dstValue, srcValue, valueSize);
+			m_pose.changedChannels.push_back(group.channelIds[i]);
+		}
+	}
+}
+
+panima::MemoryUsage panima::AnimationManager::GetMemoryUsage(bool includeAnimationSets) const
+{
+	MemoryUsage usage {};
+	usage.objects += sizeof(*this) + m_player->GetMemoryUsage() + m_animationSets.capacity() * sizeof(PAnimationSet) + m_channelValueSubmitters.capacity() * sizeof(ChannelValueSubmitter);
+	usage.caches += get_hash_map_memory_usage(m_setNameToIndex) + get_hash_map_memory_usage(m_animationNameIndex.nameToAnimation) + m_animationNameIndex.setRevisions.capacity() * sizeof(uint32_t);
+	for(auto &[name, ref] : m_animationNameIndex.nameToAnimation)
+		usage.caches += name.capacity();
+	usage.caches += m_pose.GetMemoryUsage() + m_poseLodGroups.capacity() * sizeof(PoseLodGroup);
+	for(auto &lodGroup : m_poseLodGroups)
+		usage.caches += lodGroup.sourceValues.capacity() + lodGroup.targetValues.capacity();
+	if(m_poseCache)
+		usage.caches += m_poseCache->GetMemoryUsage() / static_cast<size_t>(pragma::math::max(m_poseCache.use_count(), 1l));
+	if(includeAnimationSets) {
+		for(auto &set : m_animationSets)
+			usage += set->GetMemoryUsage();
+	}
+	return usage;
+}
+
+bool panima::AnimationManager::CanSharePose() const
+{
+	if(!m_poseSubmitter)
+		return false;
+	auto *anim = m_player->GetAnimation();
+	if(!anim)
+		return false;
+	auto &player = *m_player;
+	auto &lod = player.GetLodPolicy();
+	if(lod.updateInterval > 1 && lod.mode == Player::LodPolicy::Mode::Interpolate)
+		return false; // Requires the previous and the most recent sample of this manager
+	auto fullUpdate = player.IsFullUpdate() || m_poseAnimation.get() != anim || m_pose.channelCount != anim->GetChannels().size();
+	if(fullUpdate)
+		return true;
+	return player.ShouldSample() && !lod.skipLowPriorityChannels;
+}
+
+void panima::AnimationManager::SubmitSharedPose(const AnimationManager &source)
+{
+	auto *anim = m_player->GetAnimation();
+	auto &player = *m_player;
+	auto &channels = anim->GetChannels();
+	auto fullUpdate = player.IsFullUpdate();
+	if(m_poseAnimation.get() != anim || m_pose.channelCount != channels.size()) {
+		UpdatePoseLayout(*anim);
+		fullUpdate = true;
+	}
+	CopyPoseValues(source.m_pose, fullUpdate);
+	// Keep the pivots in sync with the values, so that subsequent individual samples don't have to search for them
+	m_poseTimestampIndices = source.m_poseTimestampIndices;
+	m_poseChannelRevisions = source.m_poseChannelRevisions;
+	m_poseSubmitter(m_pose);
+}
+
+void panima::PoseSamplingBatch::Add(AnimationManager &manager)
+{
+	auto *anim = manager->GetAnimation();
+	auto t = manager->GetCurrentTime();
+	auto timeKey = (m_timeTolerance > 0.f) ? static_cast<int64_t>(std::llround(t / m_timeTolerance)) : static_cast<int64_t>(std::bit_cast<int32_t>(t));
+	m_entries.push_back({&manager, anim, timeKey});
+}
+
+uint32_t panima::PoseSamplingBatch::Submit()
+{
+	uint32_t numSampled = 0;
+	// Managers that can't share their pose are submitted individually and moved out of the way.
+	// The order doesn't matter, so we can use the non-allocating partition.
+	auto itShared = std::partition(m_entries.begin(), m_entries.end(), [&numSampled](const Entry &entry) {
+		if(entry.manager->CanSharePose())
+			return false;
+		if(entry.manager->SubmitPose())
+			++numSampled;
+		return true;
+	});
+	std::sort(itShared, m_entries.end(), [](const Entry &a, const Entry &b) { return (a.animation != b.animation) ? std::less<const Animation *> {}(a.animation, b.animation) : (a.timeKey < b.timeKey); });
+	for(auto it = itShared; it != m_entries.end();) {
+		auto &leader = *it->manager;
+		leader.SubmitPose();
+		++numSampled;
+		auto itEnd = std::find_if(it + 1, m_entries.end(), [it](const Entry &entry) { return entry.animation != it->animation || entry.timeKey != it->timeKey; });
+		for(auto itFollower = it + 1; itFollower != itEnd; ++itFollower)
+			itFollower->manager->SubmitSharedPose(leader);
+		it = itEnd;
+	}
+	m_entries.clear();
+	return numSampled;
+}
+
 void panima::AnimationManager::ApplySliceInterpolation(const Slice &src, Slice &dst, float f)
 {
 	// TODO
@@ -3,59 +3,133 @@
 
 module;
 
+#include <version>
+#include <cassert>
+
 module panima;
 
 import :animation_set;
 import :animation;
 
-static size_t get_anim_hash(const std::string &name) { return std::hash<std::string> {}(name); }
-static size_t get_anim_hash(const std::string_view &name) { return std::hash<std::string_view> {}(name); }
-static size_t get_anim_hash(const panima::Animation &anim) { return get_anim_hash(anim.GetName()); }
 std::shared_ptr<panima::AnimationSet> panima::AnimationSet::Create() { return std::shared_ptr<AnimationSet> {new AnimationSet {}}; }
-panima::AnimationSet::AnimationSet() {}
+panima::AnimationSet::AnimationSet() { Publish(); }
+void panima::AnimationSet::Publish()
+{
+	std::scoped_lock lock {m_writeMutex};
+	auto snapshot = std::make_shared<Snapshot>();
+	snapshot->m_animations = m_animations;
+	snapshot->m_generations = m_generations;
+	snapshot->m_nameToId = m_nameToId;
+	snapshot->m_frozenIndex = m_frozenIndex;
+	snapshot->m_animationCount = GetSize();
+	snapshot->m_revision = m_revision;
+	// The previous snapshot is released once the last reader is done with it
+#ifdef __cpp_lib_atomic_shared_ptr
+	m_snapshot.store(std::move(snapshot), std::memory_order_release);
+#else
+	std::atomic_store_explicit(&m_snapshot, std::shared_ptr<const Snapshot> {std::move(snapshot)}, std::memory_order_release);
+#endif
+}
+std::shared_ptr<const panima::AnimationSet::Snapshot> panima::AnimationSet::GetSnapshot() const
+{
+#ifdef __cpp_lib_atomic_shared_ptr
+	return m_snapshot.load(std::memory_order_acquire);
+#else
+	return std::atomic_load_explicit(&m_snapshot, std::memory_order_acquire);
+#endif
+}
+void panima::AnimationSet::PublishChanges()
+{
+	if(m_updateDepth == 0)
+		Publish();
+}
+void panima::AnimationSet::BeginUpdate()
+{
+	m_writeMutex.lock();
+	++m_updateDepth;
+}
+void panima::AnimationSet::EndUpdate()
+{
+	assert(m_updateDepth > 0);
+	if(--m_updateDepth == 0)
+		Publish();
+	m_writeMutex.unlock();
+}
+uint32_t panima::AnimationSet::GetRevision() const { return GetSnapshot()->GetRevision(); }
 void panima::AnimationSet::Clear()
 {
+	std::scoped_lock lock {m_writeMutex};
+	// The generations are kept, so that ids of the cleared animations remain invalid once they're reused
+	for(auto i = decltype(m_animations.size()) {0u}; i < m_animations.size(); ++i)
+		++m_generations[i];
 	m_animations.clear();
+	m_freeIds.clear();
 	m_nameToId.clear();
+	m_frozenIndex = nullptr;
+	++m_revision;
+	PublishChanges();
 }
 void panima::AnimationSet::AddAnimation(Animation &anim)
 {
-	auto hash = get_anim_hash(anim);
-	auto it = m_nameToId.find(hash);
-	if(it != m_nameToId.end())
-		RemoveAnimation(anim);
-	m_animations.push_back(anim.shared_from_this());
-	m_nameToId.insert(std::make_pair(hash, m_animations.size() - 1));
+	std::scoped_lock lock {m_writeMutex};
+	m_frozenIndex = nullptr;
+	++m_revision;
+	auto it = m_nameToId.find(anim.GetName());
+	if(it != m_nameToId.end()) {
+		// Replace the existing animation, but keep its id. Players of the previous animation keep it alive until they're done with it.
+		m_animations[it->second] = anim.shared_from_this();
+		PublishChanges();
+		return;
+	}
+	AnimationId id;
+	if(!m_freeIds.empty()) {
+		id = m_freeIds.back();
+		m_freeIds.pop_back();
+		m_animations[id] = anim.shared_from_this();
+	}
+	else {
+		id = m_animations.size();
+		m_animations.push_back(anim.shared_from_this());
+		if(id >= m_generations.size())
+			m_generations.push_back(0);
+	}
+	m_nameToId.insert(std::make_pair(anim.GetName(), id));
+	PublishChanges();
 }
 void panima::AnimationSet::RemoveAnimation(const Animation &anim) { RemoveAnimation(anim.GetName()); }
 
 void panima::AnimationSet::RemoveAnimation(AnimationId id)
 {
-	if(id >= m_animations.size())
+	std::scoped_lock lock {m_writeMutex};
+	if(id >= m_animations.size() || !m_animations[id])
 		return;
 	RemoveAnimation(*m_animations[id]);
 }
 
 void panima::AnimationSet::RemoveAnimation(const std::string_view &animName)
 {
-	auto it = m_nameToId.find(get_anim_hash(animName));
+	std::scoped_lock lock {m_writeMutex};
+	auto it = m_nameToId.find(animName);
 	if(it == m_nameToId.end())
 		return;
+	m_frozenIndex = nullptr;
+	++m_revision;
 	auto id = it->second;
-	m_animations.erase(m_animations.begin() + id);
+	// The slot is kept so that the ids of the other animations remain valid
+	m_animations[id] = nullptr;
+	++m_generations[id];
+	m_freeIds.push_back(id);
 	m_nameToId.erase(it);
-	for(auto &pair : m_nameToId) {
-		if(id >= pair.second)
-			--pair.second;
-	}
+	PublishChanges();
 }
 
 void panima::AnimationSet::Reserve(uint32_t count)
 {
+	std::scoped_lock lock {m_writeMutex};
 	m_animations.reserve(count);
 	m_nameToId.reserve(count);
 }
-uint32_t panima::AnimationSet::GetSize() const { return m_animations.size(); }
+uint32_t panima::AnimationSet::GetSize() const { return m_animations.size() - m_freeIds.size(); }
 
 panima::Animation *panima::AnimationSet::GetAnimation(AnimationId id)
 {
@@ -72,14 +146,149 @@ panima::Animation *panima::AnimationSet::FindAnimation(const std::string_view &a
 	return GetAnimation(*id);
 }
 
-std::optional<panima::AnimationId> panima::AnimationSet::LookupAnimation(const std::string_view &animName) const
+std::optional<panima::AnimationId> panima::AnimationSet::LookupAnimation(const std::string_view &animName) const { return LookupAnimation(m_nameToId, m_frozenIndex.get(), animName); }
+
+std::optional<panima::AnimationId> panima::AnimationSet::LookupAnimation(const NameMap &nameToId, const FrozenIndex *frozenIndex, const std::string_view &animName)
 {
-	auto it = m_nameToId.find(get_anim_hash(animName));
-	if(it == m_nameToId.end())
+	if(frozenIndex)
+		return LookupFrozenAnimation(*frozenIndex, animName);
+	auto it = nameToId.find(animName);
+	if(it == nameToId.end())
 		return {};
 	return it->second;
 }
 
+uint32_t panima::AnimationSet::GetGeneration(AnimationId id) const { return (id < m_generations.size()) ? m_generations[id] : 0; }
+
+uint32_t panima::AnimationSet::Snapshot::GetGeneration(AnimationId id) const { return (id < m_generations.size()) ? m_generations[id] : 0; }
+
+std::optional<panima::AnimationId> panima::AnimationSet::Snapshot::LookupAnimation(const std::string_view &animName) const { return AnimationSet::LookupAnimation(m_nameToId, m_frozenIndex.get(), animName); }
+
+const panima::Animation *panima::AnimationSet::Snapshot::GetAnimation(AnimationId id) const
+{
+	if(id >= m_animations.size())
+		return nullptr;
+	return m_animations[id].get();
+}
+
+const panima::Animation *panima::AnimationSet::Snapshot::FindAnimation(const std::string_view &animName) const
+{
+	auto id = LookupAnimation(animName);
+	if(!id.has_value())
+		return nullptr;
+	return GetAnimation(*id);
+}
+
+static uint64_t get_displaced_hash(uint64_t hash, uint64_t seed)
+{
+	// splitmix64 finalizer
+	hash ^= seed * 0x9e3779b97f4a7c15ull;
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+	return hash ^ (hash >> 31);
+}
+
+std::optional<panima::AnimationId> panima::AnimationSet::LookupFrozenAnimation(const FrozenIndex &index, const std::string_view &animName)
+{
+	if(index.names.empty())
+		return {};
+	auto hash = NameHash {}(animName);
+	auto bucket = get_displaced_hash(hash, 0) % index.displacements.size();
+	auto slot = get_displaced_hash(hash, index.displacements[bucket]) % index.names.size();
+	if(index.names[slot] != animName)
+		return {};
+	return index.ids[slot];
+}
+
+bool panima::AnimationSet::Freeze()
+{
+	constexpr uint32_t MAX_DISPLACEMENT_ATTEMPTS = 1 << 16;
+	constexpr uint32_t KEYS_PER_BUCKET = 4;
+	std::scoped_lock lock {m_writeMutex};
+	FrozenIndex index {};
+	auto numKeys = m_nameToId.size();
+	auto numBuckets = pragma::math::max((numKeys + KEYS_PER_BUCKET - 1) / KEYS_PER_BUCKET, static_cast<size_t>(1));
+	index.displacements.resize(numBuckets, 0);
+	index.names.resize(numKeys);
+	index.ids.resize(numKeys, INVALID_ANIMATION);
+
+	std::vector<std::vector<decltype(m_nameToId)::const_pointer>> buckets {numBuckets};
+	for(auto &pair : m_nameToId)
+		buckets[get_displaced_hash(NameHash {}(pair.first), 0) % numBuckets].push_back(&pair);
+	std::vector<uint32_t> bucketOrder(numBuckets);
+	std::iota(bucketOrder.begin(), bucketOrder.end(), 0);
+	// Place the largest buckets first, while most slots are still free
+	std::sort(bucketOrder.begin(), bucketOrder.end(), [&buckets](uint32_t a, uint32_t b) { return buckets[a].size() > buckets[b].size(); });
+
+	std::vector<bool> occupied(numKeys, false);
+	std::vector<size_t> slots;
+	for(auto bucketIdx : bucketOrder) {
+		auto &bucket = buckets[bucketIdx];
+		if(bucket.empty())
+			break;
+		auto found = false;
+		for(uint32_t displacement = 1; displacement < MAX_DISPLACEMENT_ATTEMPTS; ++displacement) {
+			slots.clear();
+			auto valid = true;
+			for(auto *pair : bucket) {
+				auto slot = get_displaced_hash(NameHash {}(pair->first), displacement) % numKeys;
+				if(occupied[slot] || std::find(slots.begin(), slots.end(), slot) != slots.end()) {
+					valid = false;
+					break;
+				}
+				slots.push_back(slot);
+			}
+			if(!valid)
+				continue;
+			for(auto i = decltype(bucket.size()) {0u}; i < bucket.size(); ++i) {
+				auto slot = slots[i];
+				occupied[slot] = true;
+				index.names[slot] = bucket[i]->first;
+				index.ids[slot] = bucket[i]->second;
+			}
+			index.displacements[bucketIdx] = displacement;
+			found = true;
+			break;
+		}
+		if(!found)
+			return false; // Most likely a full hash collision between two names
+	}
+	m_frozenIndex = std::make_shared<const FrozenIndex>(std::move(index));
+	PublishChanges();
+	return true;
+}
+
+void panima::AnimationSet::Unfreeze()
+{
+	std::scoped_lock lock {m_writeMutex};
+	m_frozenIndex = nullptr;
+	PublishChanges();
+}
+
+panima::MemoryUsage panima::AnimationSet::GetMemoryUsage() const
+{
+	MemoryUsage usage {};
+	usage.objects += sizeof(*this) + m_animations.capacity() * sizeof(m_animations.front()) + m_generations.capacity() * sizeof(uint32_t) + m_freeIds.capacity() * sizeof(AnimationId);
+	for(auto &anim : m_animations) {
+		if(anim)
+			usage += anim->GetMemoryUsage();
+	}
+	usage.caches += get_hash_map_memory_usage(m_nameToId);
+	for(auto &[name, id] : m_nameToId)
+		usage.caches += name.capacity();
+	// The published snapshot holds copies of the animation list and the name map
+	auto snapshot = GetSnapshot();
+	usage.caches += sizeof(Snapshot) + snapshot->m_animations.capacity() * sizeof(m_animations.front()) + get_hash_map_memory_usage(snapshot->m_nameToId);
+	for(auto &[name, id] : snapshot->m_nameToId)
+		usage.caches += name.capacity();
+	if(m_frozenIndex) {
+		usage.caches += m_frozenIndex->displacements.capacity() * sizeof(uint32_t) + m_frozenIndex->names.capacity() * sizeof(std::string) + m_frozenIndex->ids.capacity() * sizeof(AnimationId);
+		for(auto &name : m_frozenIndex->names)
+			usage.caches += name.capacity();
+	}
+	return usage;
+}
+
 std::ostream &operator<<(std::ostream &out, const panima::AnimationSet &o)
 {
 	out << "AnimationSet";
@@ -0,0 +1,135 @@
+// SPDX-FileCopyrightText: (c) 2025 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+module panima;
+
+import :binding;
+import :animation;
+import :channel;
+import :player;
+import :instrumentation;
+
+template<typename TSrc, typename TDst>
+static void apply_bindings(panima::ChannelBindingTable::Binding *bindings, size_t count, float t, bool skipLowPriority, bool skipUnchanged, uint8_t *base)
+{
+	for(auto i = decltype(count) {0u}; i < count; ++i) {
+		auto &binding = bindings[i];
+		if(skipLowPriority && binding.channel->HasFlags(panima::Channel::Flags::LowPriority))
+			continue;
+		// The pivot of the player may have been advanced by a different consumer, so we have to use our own
+		auto &pivotTimeIndex = binding.timestampIndex;
+		// The pivot is only meaningful if the channel hasn't been modified since
+		if(skipUnchanged && binding.revision == binding.channel->GetRevision() && binding.channel->IsSampleUnchanged(t, pivotTimeIndex)) {
+			panima::instrumentation::increment(panima::instrumentation::Counter::ChannelSampleSkipped);
+			continue;
+		}
+		binding.revision = binding.channel->GetRevision();
+		panima::instrumentation::increment(panima::instrumentation::Counter::ChannelSample);
+		auto value = binding.channel->GetInterpolatedValue<TSrc>(t, pivotTimeIndex);
+		if constexpr(panima::is_supported_expression_type_v<TSrc>) {
+			if(binding.channel->GetValueExpression())
+				binding.channel->ApplyValueExpression<TSrc>(t, pivotTimeIndex, value);
+		}
+		auto &dst = *reinterpret_cast<TDst *>(base + binding.offset);
+		if constexpr(std::is_same_v<TSrc, TDst>)
+			dst = value;
+		else
+			dst = udm::convert<TSrc, TDst>(value);
+	}
+}
+
+static panima::ChannelBindingTable::Kernel get_kernel(udm::Type srcType, udm::Type dstType)
+{
+	if(!panima::is_animatable_type(srcType) || !panima::is_animatable_type(dstType))
+		return nullptr;
+	return udm::visit_ng(srcType, [dstType](auto tagSrc) -> panima::ChannelBindingTable::Kernel {
+		using TSrc = typename decltype(tagSrc)::type;
+		if constexpr(!panima::is_animatable_type(udm::type_to_enum<TSrc>()))
+			return nullptr;
+		else {
+			return udm::visit_ng(dstType, [](auto tagDst) -> panima::ChannelBindingTable::Kernel {
+				using TDst = typename decltype(tagDst)::type;
+				if constexpr(!panima::is_animatable_type(udm::type_to_enum<TDst>()))
+					return nullptr;
+				else if constexpr(std::is_same_v<TSrc, TDst> || udm::is_convertible<TSrc, TDst>())
+					return &apply_bindings<TSrc, TDst>;
+				else
+					return nullptr;
+			});
+		}
+	});
+}
+
+void panima::ChannelBindingTable::SetAnimation(const Animation &anim)
+{
+	Clear();
+	m_animation = anim.shared_from_this();
+}
+
+void panima::ChannelBindingTable::Clear()
+{
+	m_groups.clear();
+	m_lastPlayer = nullptr;
+	m_lastBase = nullptr;
+}
+
+uint32_t panima::ChannelBindingTable::GetBindingCount() const
+{
+	uint32_t count = 0;
+	for(auto &group : m_groups)
+		count += group.bindings.size();
+	return count;
+}
+
+bool panima::ChannelBindingTable::Bind(const ChannelPath &path, udm::Type dstType, size_t offset)
+{
+	if(!m_animation)
+		return false;
+	auto *channel = m_animation->FindChannel(path);
+	if(!channel)
+		return false;
+	auto &channels = m_animation->GetChannels();
+	auto it = std::find_if(channels.begin(), channels.end(), [channel](const std::shared_ptr<Channel> &other) { return other.get() == channel; });
+	return Bind(static_cast<AnimationChannelId>(it - channels.begin()), dstType, offset);
+}
+
+bool panima::ChannelBindingTable::Bind(AnimationChannelId channelIndex, udm::Type dstType, size_t offset)
+{
+	if(!m_animation)
+		return false;
+	auto &channels = m_animation->GetChannels();
+	if(channelIndex >= channels.size())
+		return false;
+	auto &channel = *channels[channelIndex];
+	auto srcType = channel.GetValueType();
+	auto it = std::find_if(m_groups.begin(), m_groups.end(), [srcType, dstType](const KernelGroup &group) { return group.srcType == srcType && group.dstType == dstType; });
+	if(it == m_groups.end()) {
+		auto kernel = get_kernel(srcType, dstType);
+		if(!kernel)
+			return false;
+		m_groups.push_back({srcType, dstType, kernel});
+		it = m_groups.end() - 1;
+	}
+	it->bindings.push_back({&channel, channelIndex, offset});
+	return true;
+}
+
+bool panima::ChannelBindingTable::Apply(Player &player, void *base)
+{
+	if(!m_animation || player.GetAnimation() != m_animation.get())
+		return false;
+	instrumentation::ScopedTimer timer {instrumentation::Timer::BindingApply};
+	// The previously written values are only known for the same player and destination
+	auto fullUpdate = player.IsFullUpdate() || &player != m_lastPlayer || base != m_lastBase;
+	if(!fullUpdate && !player.ShouldSample())
+		return false;
+	m_lastPlayer = &player;
+	m_lastBase = base;
+	auto skipLowPriority = player.GetLodPolicy().skipLowPriorityChannels && !fullUpdate;
+	auto t = player.GetCurrentTime();
+	for(auto &group : m_groups)
+		group.kernel(group.bindings.data(), group.bindings.size(), t, skipLowPriority, !fullUpdate, static_cast<uint8_t *>(base));
+	return true;
+}
@@ -11,8 +11,131 @@ import bezierfit;
 
 import :channel;
 import :expression;
+import :instrumentation;
+
+uint64_t panima::get_next_revision()
+{
+	static std::atomic<uint64_t> g_revision = 0;
+	return ++g_revision;
+}
+
+namespace panima {
+	struct ChannelPathRegistry {
+		struct Entry {
+			pragma::util::Path path;
+			std::optional<std::vector<std::string>> components;
+		};
+		ChannelPathRegistry()
+		{
+			// Reserve id 0 for the empty path
+			keyToId[""] = 0;
+			entries.push_back({});
+		}
+		std::shared_mutex mutex;
+		// Unparsed path strings, so that each distinct string only has to be parsed once
+		std::unordered_map<std::string, ChannelPathId> uriToId;
+		std::unordered_map<std::string, ChannelPathId> keyToId;
+		std::deque<Entry> entries;
+	};
+	static ChannelPathRegistry &get_channel_path_registry()
+	{
+		static ChannelPathRegistry registry {};
+		return registry;
+	}
+};
+
+size_t panima::ChannelPath::GetRegistryMemoryUsage()
+{
+	auto &registry = get_channel_path_registry();
+	std::shared_lock lock {registry.mutex};
+	auto size = sizeof(registry) + get_hash_map_memory_usage(registry.uriToId) + get_hash_map_memory_usage(registry.keyToId) + registry.entries.size() * sizeof(ChannelPathRegistry::Entry);
+	for(auto &[uri, id] : registry.uriToId)
+		size += uri.capacity();
+	for(auto &[key, id] : registry.keyToId)
+		size += key.capacity();
+	for(auto &entry : registry.entries) {
+		size += entry.path.GetString().size();
+		if(entry.components) {
+			size += entry.components->capacity() * sizeof(std::string);
+			for(auto &c : *entry.components)
+				size += c.capacity();
+		}
+	}
+	return size;
+}
 
 panima::ChannelPath::ChannelPath(const std::string &ppath)
+{
+	auto &registry = get_channel_path_registry();
+	{
+		std::shared_lock lock {registry.mutex};
+		auto it = registry.uriToId.find(ppath);
+		if(it != registry.uriToId.end()) {
+			auto &entry = registry.entries[it->second];
+			m_path = entry.path;
+			if(entry.components)
+				m_components = std::make_unique<std::vector<std::string>>(*entry.components);
+			m_id = it->second;
+			return;
+		}
+	}
+	Parse(ppath);
+	Intern();
+
+	std::unique_lock lock {registry.mutex};
+	registry.uriToId[ppath] = m_id;
+}
+
+void panima::ChannelPath::SetPath(pragma::util::Path path)
+{
+	m_path = std::move(path);
+	Intern();
+}
+
+void panima::ChannelPath::SetComponents(std::vector<std::string> components)
+{
+	m_components = std::make_unique<std::vector<std::string>>(std::move(components));
+	Intern();
+}
+
+void panima::ChannelPath::ClearComponents()
+{
+	m_components = nullptr;
+	Intern();
+}
+
+void panima::ChannelPath::Intern()
+{
+	std::string key = m_path.GetString();
+	if(m_components) {
+		// Components can't contain null characters, so this key can't be ambiguous
+		key += '\0';
+		for(auto &c : *m_components) {
+			key += c;
+			key += '\0';
+		}
+	}
+	auto &registry = get_channel_path_registry();
+	{
+		std::shared_lock lock {registry.mutex};
+		auto it = registry.keyToId.find(key);
+		if(it != registry.keyToId.end()) {
+			m_id = it->second;
+			return;
+		}
+	}
+	std::unique_lock lock {registry.mutex};
+	auto [it, inserted] = registry.keyToId.insert({std::move(key), static_cast<ChannelPathId>(registry.entries.size())});
+	if(inserted) {
+		auto &entry = registry.entries.emplace_back();
+		entry.path = m_path;
+		if(m_components)
+			entry.components = *m_components;
+	}
+	m_id = it->second;
+}
+
+void panima::ChannelPath::Parse(const std::string &ppath)
 {
 	auto pathWithoutScheme = ppath;
 	auto colon = pathWithoutScheme.find(':');
@@ -31,7 +154,7 @@ panima::ChannelPath::ChannelPath(const std::string &ppath)
 	if(!strPath.empty() && strPath.front() == '/')
 		strPath.erase(strPath.begin());
 	pragma::string::replace(strPath, "%20", " ");
-	path = std::move(uriparser::unescape(strPath));
+	m_path = std::move(uriparser::unescape(strPath));
 	auto strQueries = uri.query();
 	std::vector<std::string> queries;
 	pragma::string::explode(strQueries, "&", queries);
@@ -49,21 +172,22 @@ panima::ChannelPath::ChannelPath(const std::string &ppath)
 	}
 }
 panima::ChannelPath::ChannelPath(const ChannelPath &other) { operator=(other); }
-bool panima::ChannelPath::operator==(const ChannelPath &other) const { return path == other.path && ((!m_components && !other.m_components) || (m_components && other.m_components && *m_components == *other.m_components)); }
 panima::ChannelPath &panima::ChannelPath::operator=(const ChannelPath &other)
 {
-	path = other.path;
+	m_path = other.m_path;
 	m_components = nullptr;
 	if(other.m_components)
 		m_components = std::make_unique<std::vector<std::string>>(*other.m_components);
+	m_id = other.m_id;
 	return *this;
 }
+size_t panima::ChannelPath::GetHash() const { return std::hash<ChannelPathId> {}(m_id); }
 std::string panima::ChannelPath::ToUri(bool includeScheme) const
 {
 	std::string uri;
 	if(includeScheme)
 		uri = "panima:";
-	uri += path.GetString();
+	uri += m_path.GetString();
 	if(m_components) {
 		std::string strComponents;
 		for(auto first = true; auto &c : *m_components) {
@@ -121,22 +245,47 @@ panima::Channel::Channel(Channel &other) : Channel {} { operator=(other); }
 panima::Channel::~Channel() {}
 panima::Channel &panima::Channel::operator=(Channel &other)
 {
-	interpolation = other.interpolation;
-	targetPath = other.targetPath;
+	if(!CheckMutable())
+		return *this;
+	other.ResolveDeferredLoad();
+	m_deferredLoad = nullptr;
 	m_times = other.m_times->Copy(true);
 	m_values = other.m_values->Copy(true);
+	UpdateLookupCache();
+	CopyState(other);
+	m_flatSegments = other.m_flatSegments;
+	m_constant = other.m_constant;
+	m_frozen = false;
+	return *this;
+}
+void panima::Channel::CopyState(const Channel &other)
+{
+	interpolation = other.interpolation;
+	targetPath = other.targetPath;
 	m_valueExpression = nullptr;
 	if(other.m_valueExpression)
-		m_valueExpression = std::make_unique<expression::ValueExpression>(*other.m_valueExpression);
+		m_valueExpression = std::make_unique<expression::ValueExpression>(*this, *other.m_valueExpression);
 	m_timeFrame = other.m_timeFrame;
 	m_effectiveTimeFrame = other.m_effectiveTimeFrame;
-	UpdateLookupCache();
-	return *this;
+	m_flags = other.m_flags;
+}
+bool panima::Channel::CheckMutable() const
+{
+	// Frozen channels may be sampled by multiple threads at once
+	assert(!m_frozen && "Frozen channels must not be modified");
+	return !m_frozen;
 }
 bool panima::Channel::Save(udm::LinkedPropertyWrapper &prop) const
 {
 	prop["interpolation"] = interpolation;
 	prop["targetPath"] = targetPath.ToUri();
+	if(m_flags != Flags::None)
+		prop["flags"] = udm::flags_to_string(m_flags);
+	if(m_deferredLoad) {
+		std::scoped_lock lock {m_deferredLoad->mutex};
+		if(m_deferredLoad->pending && m_deferredLoad->expression)
+			prop["expression"] = *m_deferredLoad->expression;
+	}
 	if(m_valueExpression)
 		prop["expression"] = m_valueExpression->expression;
 
@@ -144,12 +293,16 @@ bool panima::Channel::Save(udm::LinkedPropertyWrapper &prop) const
 	prop["values"] = m_values;
 	return true;
 }
-bool panima::Channel::Load(udm::LinkedPropertyWrapper &prop)
+bool panima::Channel::Load(udm::LinkedPropertyWrapper &prop, bool deferred)
 {
+	if(!CheckMutable())
+		return false;
+	m_deferredLoad = nullptr;
 	prop["interpolation"](interpolation);
 	std::string targetPath;
 	prop["targetPath"](targetPath);
 	this->targetPath = std::move(targetPath);
+	udm::to_flags<Flags>(prop["flags"], m_flags);
 
 	auto *el = prop.GetValuePtr<udm::Element>();
 	if(!el)
@@ -160,6 +313,23 @@ bool panima::Channel::Load(udm::LinkedPropertyWrapper &prop)
 		return false;
 	m_times = itTimes->second;
 	m_values = itValues->second;
+	m_valueExpression = nullptr;
+	if(deferred) {
+		// Only the array pointers are required for now, accessing the data would decompress it
+		m_timesArray = m_times->GetValuePtr<udm::Array>();
+		m_valueArray = m_values->GetValuePtr<udm::Array>();
+		m_timesData = nullptr;
+		m_valueData = nullptr;
+		m_deferredLoad = std::make_unique<DeferredLoadState>();
+		auto udmExpression = prop["expression"];
+		if(udmExpression) {
+			std::string expr;
+			udmExpression(expr);
+			m_deferredLoad->expression = std::move(expr);
+		}
+		InvalidateSampleInfo();
+		return true;
+	}
 	UpdateLookupCache();
 
 	// Note: Expression has to be loaded *after* the values, because
@@ -172,23 +342,156 @@ bool panima::Channel::Load(udm::LinkedPropertyWrapper &prop)
 		if(SetValueExpression(expr, err) == false)
 			; // TODO: Print warning?
 	}
+	UpdateSampleInfo();
 	return true;
 }
+void panima::Channel::DoResolveDeferredLoad() const
+{
+	auto &state = *m_deferredLoad;
+	std::scoped_lock lock {state.mutex};
+	// The data is accessed by the resolve itself, which has to go through
+	if(!state.pending || state.resolving)
+		return;
+	state.resolving = true;
+	auto &self = const_cast<Channel &>(*this);
+	self.UpdateLookupCache();
+	if(state.expression) {
+		std::string err;
+		if(self.SetValueExpression(std::move(*state.expression), err) == false)
+			; // TODO: Print warning?
+		state.expression = {};
+	}
+	self.UpdateSampleInfo();
+	state.resolving = false;
+	state.pending.store(false, std::memory_order_release);
+}
 uint32_t panima::Channel::GetSize() const { return GetTimesArray().GetSize(); }
 void panima::Channel::Resize(uint32_t numValues)
 {
+	if(!CheckMutable())
+		return;
 	m_times->GetValue<udm::Array>().Resize(numValues);
 	m_values->GetValue<udm::Array>().Resize(numValues);
+	instrumentation::increment(instrumentation::Counter::ArrayResize);
 	UpdateLookupCache();
 }
+void panima::Channel::SetTimeFrame(TimeFrame timeFrame)
+{
+	if(!CheckMutable())
+		return;
+	m_timeFrame = std::move(timeFrame);
+	// Samples at the same time may now map to different keyframes
+	m_revision = get_next_revision();
+}
 void panima::Channel::Update()
 {
+	if(!CheckMutable())
+		return;
 	m_effectiveTimeFrame = m_timeFrame;
 	if(m_effectiveTimeFrame.duration < 0.f)
 		m_effectiveTimeFrame.duration = GetMaxTime();
+	UpdateSampleInfo();
+}
+void panima::Channel::UpdateSampleInfo()
+{
+	if(!CheckMutable())
+		return;
+	m_revision = get_next_revision();
+	auto numValues = GetValueCount();
+	m_flatSegments.clear();
+	m_constant = (numValues > 0);
+	if(numValues < 2)
+		return;
+	auto valueSize = udm::size_of_base_type(GetValueType());
+	auto *data = static_cast<const uint8_t *>(m_valueData);
+	m_flatSegments.resize(numValues - 1);
+	for(auto i = decltype(numValues) {0u}; i < numValues - 1; ++i) {
+		auto flat = (memcmp(data + i * valueSize, data + (i + 1) * valueSize, valueSize) == 0);
+		m_flatSegments[i] = flat;
+		m_constant = m_constant && flat;
+	}
+}
+// Copies the array into an uncompressed array, which doesn't have any lazily decompressed state
+static udm::PProperty make_resident_array(udm::Property &prop)
+{
+	auto &a = prop.GetValue<udm::Array>();
+	// Non-trivial value types can't be copied directly
+	if(!udm::is_trivial_type(a.GetValueType()))
+		return prop.Copy(true);
+	auto resident = udm::Property::Create(udm::Type::Array);
+	auto &residentArray = resident->GetValue<udm::Array>();
+	residentArray.SetValueType(a.GetValueType());
+	residentArray.Resize(a.GetSize());
+	if(a.GetSize() > 0)
+		memcpy(residentArray.GetValuePtr(0), a.GetValuePtr(0), a.GetSize() * a.GetValueSize());
+	return resident;
+}
+std::shared_ptr<const panima::Channel> panima::Channel::Freeze() const
+{
+	ResolveDeferredLoad();
+	// The keyframe arrays are copied once, directly into their resident form
+	auto frozen = std::make_shared<Channel>(make_resident_array(*m_times), make_resident_array(*m_values));
+	frozen->CopyState(*this);
+	frozen->UpdateSampleInfo();
+	frozen->m_frozen = true;
+	return frozen;
+}
+// Compressed arrays only hold their uncompressed data once it has been accessed through the channel (see UpdateLookupCache),
+// which is not the case for channels with a pending deferred load
+static void add_array_memory_usage(const udm::Array &a, bool resident, panima::MemoryUsage &usage)
+{
+	auto compressed = (a.GetArrayType() == udm::ArrayType::Compressed);
+	if(!compressed || resident)
+		usage.keyframes += a.GetSize() * a.GetValueSize();
+	if(compressed)
+		usage.compressedKeyframes += static_cast<const udm::ArrayLz4 &>(a).GetCompressedBlob().compressedData.size();
+}
+panima::MemoryUsage panima::Channel::GetMemoryUsage() const
+{
+	MemoryUsage usage {};
+	usage.objects += sizeof(*this) + sizeof(udm::Property) * 2;
+	// The arrays are accessed directly, so that deferred channels aren't decompressed
+	auto resident = !IsLoadDeferred();
+	add_array_memory_usage(*m_timesArray, resident, usage);
+	add_array_memory_usage(*m_valueArray, resident, usage);
+	usage.caches += m_flatSegments.capacity() / 8;
+	if(m_valueExpression)
+		usage.expressions += m_valueExpression->GetMemoryUsage();
+	return usage;
+}
+bool panima::Channel::IsSampleUnchanged(float t, uint32_t pivotTimeIndex) const
+{
+	ResolveDeferredLoad();
+	auto numValues = GetValueCount();
+	if(pivotTimeIndex >= numValues)
+		return false; // No previous sample
+	if(m_valueExpression) {
+		if(m_valueExpression->IsConstant())
+			return true;
+		// The result only depends on the interpolated value if the expression doesn't use anything else
+		auto timeDependentFlags = expression::ExpressionFlags::UsesTime | expression::ExpressionFlags::UsesTimeIndex | expression::ExpressionFlags::UsesTimeFrame | expression::ExpressionFlags::UsesValueAt | expression::ExpressionFlags::Impure;
+		if((m_valueExpression->GetFlags() & timeDependentFlags) != expression::ExpressionFlags::None)
+			return false;
+	}
+	if(m_constant)
+		return true;
+	if(m_flatSegments.size() != numValues - 1)
+		return false; // Sample info is out of date
+	float factor;
+	auto indices = FindInterpolationIndices(t, factor, pivotTimeIndex);
+	if(indices.first != pivotTimeIndex)
+		return false;
+	// Past the last keyframe the value is constant
+	if(indices.first == numValues - 1)
+		return true;
+	// Before the first keyframe the value of the first keyframe is used, which is also
+	// the value of the entire first segment if it is flat
+	return m_flatSegments[indices.first];
 }
 size_t panima::Channel::Optimize()
 {
+	if(!CheckMutable())
+		return 0;
 	auto numTimes = GetTimeCount();
 	constexpr auto EPSILON = 0.001f;
 	size_t numRemoved = 0;
@@ -242,11 +545,13 @@ size_t panima::Channel::Optimize()
 		});
 	}
 
+	UpdateSampleInfo();
 	return numRemoved;
 }
 template<typename T>
 bool panima::Channel::DoApplyValueExpression(double time, uint32_t timeIndex, T &inOutVal) const
 {
+	ResolveDeferredLoad();
 	if(!m_valueExpression)
 		return false;
 	m_valueExpression->Apply<T>(time, timeIndex, m_effectiveTimeFrame, inOutVal);
@@ -288,6 +593,8 @@ float panima::Channel::GetMaxTime() const
 }
 void panima::Channel::MergeValues(const Channel &other)
 {
+	if(!CheckMutable())
+		return;
 	if(!udm::is_convertible(other.GetValueType(), GetValueType()))
 		return;
 	auto startTime = other.GetMinTime();
@@ -329,12 +636,16 @@ void panima::Channel::MergeValues(const Channel &other)
 }
 void panima::Channel::ClearAnimationData()
 {
+	if(!CheckMutable())
+		return;
 	GetTimesArray().Resize(0);
 	GetValueArray().Resize(0);
 	UpdateLookupCache();
 }
 bool panima::Channel::ClearRange(float startTime, float endTime, bool addCaps)
 {
+	if(!CheckMutable())
+		return false;
 	if(GetTimesArray().IsEmpty())
 		return true;
 	auto minTime = *GetTime(0);
@@ -371,9 +682,21 @@ bool panima::Channel::ClearRange(float startTime, float endTime, bool addCaps)
 	});
 	return true;
 }
-void panima::Channel::ClearValueExpression() { m_valueExpression = nullptr; }
+void panima::Channel::ClearValueExpression()
+{
+	if(!CheckMutable())
+		return;
+	ResolveDeferredLoad();
+	m_valueExpression = nullptr;
+	m_revision = get_next_revision();
+}
 bool panima::Channel::TestValueExpression(std::string expression, std::string &outErr)
 {
+	if(!CheckMutable()) {
+		outErr = "Channel is frozen";
+		return false;
+	}
+	ResolveDeferredLoad();
 	m_valueExpression = nullptr;
 
 	auto expr = std::make_unique<expression::ValueExpression>(*this);
@@ -384,7 +707,13 @@ bool panima::Channel::TestValueExpression(std::string expression, std::string &o
 }
 bool panima::Channel::SetValueExpression(std::string expression, std::string &outErr)
 {
+	if(!CheckMutable()) {
+		outErr = "Channel is frozen";
+		return false;
+	}
+	ResolveDeferredLoad();
 	m_valueExpression = nullptr;
+	m_revision = get_next_revision();
 
 	auto expr = std::make_unique<expression::ValueExpression>(*this);
 	expr->expression = std::move(expression);
@@ -395,10 +724,102 @@ bool panima::Channel::SetValueExpression(std::string expression, std::string &ou
 }
 const std::string *panima::Channel::GetValueExpression() const
 {
+	ResolveDeferredLoad();
 	if(m_valueExpression)
 		return &m_valueExpression->expression;
 	return nullptr;
 }
+bool panima::Channel::IsValueExpressionConstant() const
+{
+	ResolveDeferredLoad();
+	return m_valueExpression && m_valueExpression->IsConstant();
+}
+bool panima::Channel::IsValueExpressionValueIndependent() const
+{
+	ResolveDeferredLoad();
+	return m_valueExpression && m_valueExpression->IsValueIndependent();
+}
+bool panima::Channel::IsValueExpressionImpure() const
+{
+	ResolveDeferredLoad();
+	return m_valueExpression && (m_valueExpression->GetFlags() & expression::ExpressionFlags::Impure) != expression::ExpressionFlags::None;
+}
+bool panima::Channel::BakeValueExpression(const ExpressionBakeInfo &bakeInfo)
+{
+	if(!CheckMutable())
+		return false;
+	ResolveDeferredLoad();
+	if(!m_valueExpression || bakeInfo.sampleRate <= 0.f)
+		return false;
+	// Keyframe times are in the local time frame of the channel, but the expression
+	// is evaluated in animation time, so we have to convert between the two.
+	auto localToGlobalTime = [this](float t) { return (m_timeFrame.scale != 0.f) ? (t / m_timeFrame.scale + m_timeFrame.startOffset) : m_timeFrame.startOffset; };
+	std::optional<std::pair<float, float>> timeRange {};
+	auto numTimes = GetTimeCount();
+	if(numTimes > 0)
+		timeRange = std::pair<float, float> {localToGlobalTime(*GetTime(0)), localToGlobalTime(*GetTime(numTimes - 1))};
+	if(bakeInfo.timeRange) {
+		if(timeRange)
+			timeRange = std::pair<float, float> {pragma::math::min(timeRange->first, bakeInfo.timeRange->first), pragma::math::max(timeRange->second, bakeInfo.timeRange->second)};
+		else
+			timeRange = bakeInfo.timeRange;
+	}
+	if(!timeRange || timeRange->second < timeRange->first)
+		return false;
+	auto [tStart, tEnd] = *timeRange;
+
+	// Sample at a fixed rate, but also include the existing keyframes to retain sharp features
+	std::vector<float> sampleTimes;
+	if(m_valueExpression->IsConstant()) {
+		// The result is the same for every sample, so a single key is sufficient
+		sampleTimes.push_back(tStart);
+		numTimes = 0;
+	}
+	auto numSamples = sampleTimes.empty() ? (static_cast<uint32_t>(std::ceil((tEnd - tStart) * bakeInfo.sampleRate)) + 1) : 0u;
+	sampleTimes.reserve(numSamples + numTimes);
+	for(auto i = decltype(numSamples) {0u}; i < numSamples; ++i)
+		sampleTimes.push_back(pragma::math::min(tStart + static_cast<float>(i) / bakeInfo.sampleRate, tEnd));
+	for(auto i = decltype(numTimes) {0u}; i < numTimes; ++i) {
+		auto t = localToGlobalTime(*GetTime(i));
+		if(t >= tStart && t <= tEnd)
+			sampleTimes.push_back(t);
+	}
+	std::sort(sampleTimes.begin(), sampleTimes.end());
+
+	return udm::visit_ng(GetValueType(), [this, &bakeInfo, &sampleTimes](auto tag) -> bool {
+		using T = typename decltype(tag)::type;
+		using TValue = std::conditional_t<std::is_same_v<T, bool>, uint8_t, T>;
+		if constexpr(is_animatable_type(udm::type_to_enum<T>()) && is_supported_expression_type_v<T>) {
+			// All samples have to be evaluated before we touch the channel data, since
+			// the expression may reference the original values (e.g. via value_at)
+			std::vector<float> times;
+			std::vector<TValue> values;
+			times.reserve(sampleTimes.size());
+			values.reserve(sampleTimes.size());
+			uint32_t pivotTimeIndex = 0;
+			for(auto t : sampleTimes) {
+				auto tLocal = t;
+				TimeToLocalTimeFrame(tLocal);
+				if(!times.empty() && tLocal <= times.back() + TIME_EPSILON)
+					continue; // Duplicate, or clamped by the time frame duration
+				auto value = GetInterpolatedValue<T>(t, pivotTimeIndex);
+				m_valueExpression->Apply<T>(t, pivotTimeIndex, m_effectiveTimeFrame, value);
+				times.push_back(tLocal);
+				values.push_back(static_cast<TValue>(value));
+			}
+			if(times.empty())
+				return false;
+
+			ClearValueExpression();
+			ClearAnimationData();
+			InsertValues<TValue>(times.size(), times.data(), values.data());
+			if(bakeInfo.decimationError)
+				Decimate(*bakeInfo.decimationError);
+			return true;
+		}
+		return false;
+	});
+}
 void panima::Channel::MergeDataArrays(uint32_t n0, const float *times0, const uint8_t *values0, uint32_t n1, const float *times1, const uint8_t *values1, std::vector<float> &outTimes, const std::function<uint8_t *(size_t)> &fAllocateValueData, size_t valueStride)
 {
 	outTimes.resize(n0 + n1);
@@ -520,6 +941,8 @@ void panima::Channel::GetDataInRange(float tStart, float tEnd, std::vector<float
 void panima::Channel::GetTimesInRange(float tStart, float tEnd, std::vector<float> &outTimes) const { GetDataInRange(tStart, tEnd, &outTimes, nullptr); }
 void panima::Channel::Decimate(float error)
 {
+	if(!CheckMutable())
+		return;
 	auto n = GetTimeCount();
 	if(n < 2)
 		return;
@@ -527,6 +950,8 @@ void panima::Channel::Decimate(float error)
 }
 std::optional<uint32_t> panima::Channel::InsertSample(float t)
 {
+	if(!CheckMutable())
+		return {};
 	if(GetTimeCount() == 0)
 		return {};
 	float f;
@@ -544,6 +969,8 @@ std::optional<uint32_t> panima::Channel::InsertSample(float t)
 }
 void panima::Channel::TransformGlobal(const pragma::math::ScaledTransform &transform)
 {
+	if(!CheckMutable())
+		return;
 	auto valueType = GetValueType();
 	auto numTimes = GetTimeCount();
 	switch(valueType) {
@@ -566,11 +993,15 @@ void panima::Channel::TransformGlobal(const pragma::math::ScaledTransform &trans
 			break;
 		}
 	default:
-		break;
+		return;
 	}
+	// The values were modified in-place
+	InvalidateSampleInfo();
 }
 void panima::Channel::RemoveValueAtIndex(uint32_t idx)
 {
+	if(!CheckMutable())
+		return;
 	auto &times = GetTimesArray();
 	times.RemoveValue(idx);
 
@@ -580,6 +1011,8 @@ void panima::Channel::RemoveValueAtIndex(uint32_t idx)
 }
 void panima::Channel::ResolveDuplicates(float t)
 {
+	if(!CheckMutable())
+		return;
 	for(;;) {
 		auto idx = FindValueIndex(t);
 		if(!idx)
@@ -643,6 +1076,8 @@ std::pair<std::optional<uint32_t>, std::optional<uint32_t>> panima::Channel::Get
 }
 void panima::Channel::ShiftTimeInRange(float tStart, float tEnd, float shiftAmount, bool retainBoundaryValues)
 {
+	if(!CheckMutable())
+		return;
 	if(pragma::math::abs(shiftAmount) <= TIME_EPSILON * 1.5f)
 		return;
 	auto [idxStart, idxEnd] = GetBoundaryIndices(tStart, tEnd, retainBoundaryValues);
@@ -682,6 +1117,8 @@ void panima::Channel::ShiftTimeInRange(float tStart, float tEnd, float shiftAmou
 		auto &t = times.GetValue<float>(idx);
 		t += shiftAmount;
 	}
+	// The times were modified in-place
+	InvalidateSampleInfo();
 	ResolveDuplicates(*GetTime(*idxStart));
 	ResolveDuplicates(*GetTime(*idxEnd));
 	if(retainBoundaryValues) {
@@ -696,6 +1133,8 @@ void panima::Channel::ShiftTimeInRange(float tStart, float tEnd, float shiftAmou
 }
 void panima::Channel::ScaleTimeInRange(float tStart, float tEnd, float tPivot, double scale, bool retainBoundaryValues)
 {
+	if(!CheckMutable())
+		return;
 	auto [idxStart, idxEnd] = GetBoundaryIndices(tStart, tEnd, retainBoundaryValues);
 	if(!idxStart || !idxEnd)
 		return;
@@ -745,6 +1184,7 @@ void panima::Channel::ScaleTimeInRange(float tStart, float tEnd, float tPivot, d
 		auto &t = times.GetValue<float>(idx);
 		t = rescale(t);
 	}
+	InvalidateSampleInfo();
 	ResolveDuplicates(*GetTime(*idxStart));
 	ResolveDuplicates(*GetTime(*idxEnd));
 
@@ -767,6 +1207,8 @@ void panima::Channel::ScaleTimeInRange(float tStart, float tEnd, float tPivot, d
 }
 void panima::Channel::Decimate(float tStart, float tEnd, float error)
 {
+	if(!CheckMutable())
+		return;
 	return udm::visit_ng(GetValueType(), [this, tStart, tEnd, error](auto tag) {
 		using T = typename decltype(tag)::type;
 		using TValue = std::conditional_t<std::is_same_v<T, bool>, uint8_t, T>;
@@ -816,6 +1258,8 @@ void panima::Channel::Decimate(float tStart, float tEnd, float error)
 }
 uint32_t panima::Channel::InsertValues(uint32_t n, const float *times, const void *values, size_t valueStride, float offset, InsertFlags flags)
 {
+	if(!CheckMutable())
+		return std::numeric_limits<uint32_t>::max();
 	if(n == 0)
 		return std::numeric_limits<uint32_t>::max();
 	if(offset != 0.f) {
@@ -889,6 +1333,8 @@ uint32_t panima::Channel::InsertValues(uint32_t n, const float *times, const voi
 }
 uint32_t panima::Channel::AddValue(float t, const void *value)
 {
+	if(!CheckMutable())
+		return std::numeric_limits<uint32_t>::max();
 	float interpFactor;
 	auto indices = FindInterpolationIndices(t, interpFactor);
 	if(indices.first == std::numeric_limits<decltype(indices.first)>::max()) {
@@ -897,6 +1343,7 @@ uint32_t panima::Channel::AddValue(float t, const void *value)
 		auto idx = size - 1;
 		GetTimesArray()[idx] = t;
 		GetValueArray()[idx] = value;
+		InvalidateSampleInfo();
 		return idx;
 	}
 	if(pragma::math::abs(t - *GetTime(indices.first)) < VALUE_EPSILON) {
@@ -904,6 +1351,7 @@ uint32_t panima::Channel::AddValue(float t, const void *value)
 		auto idx = indices.first;
 		GetTimesArray()[idx] = t;
 		GetValueArray()[idx] = value;
+		InvalidateSampleInfo();
 		return idx;
 	}
 	if(pragma::math::abs(t - *GetTime(indices.second)) < VALUE_EPSILON) {
@@ -911,6 +1359,7 @@ uint32_t panima::Channel::AddValue(float t, const void *value)
 		auto idx = indices.second;
 		GetTimesArray()[idx] = t;
 		GetValueArray()[idx] = value;
+		InvalidateSampleInfo();
 		return idx;
 	}
 	auto &times = GetTimesArray();
@@ -920,6 +1369,7 @@ uint32_t panima::Channel::AddValue(float t, const void *value)
 			// New time value preceeds first time value in time array, push front
 			auto idx = indices.first;
 			times.InsertValue(idx, t);
+			instrumentation::increment(instrumentation::Counter::ArrayResize);
 			udm::visit_ng(GetValueType(), [&values, idx, value](auto tag) {
 				using T = typename decltype(tag)::type;
 				values.InsertValue(idx, *static_cast<const T *>(value));
@@ -930,6 +1380,7 @@ uint32_t panima::Channel::AddValue(float t, const void *value)
 		// New time value exceeds last time value in time array, push back
 		auto idx = indices.second + 1;
 		times.InsertValue(idx, t);
+		instrumentation::increment(instrumentation::Counter::ArrayResize);
 		udm::visit_ng(GetValueType(), [&values, idx, value](auto tag) {
 			using T = typename decltype(tag)::type;
 			values.InsertValue(idx, *static_cast<const T *>(value));
@@ -940,6 +1391,7 @@ uint32_t panima::Channel::AddValue(float t, const void *value)
 	// Insert new value between the two indices
 	auto idx = indices.second;
 	times.InsertValue(idx, t);
+	instrumentation::increment(instrumentation::Counter::ArrayResize);
 	udm::visit_ng(GetValueType(), [&values, idx, value](auto tag) {
 		using T = typename decltype(tag)::type;
 		values.InsertValue(idx, *static_cast<const T *>(value));
@@ -958,11 +1410,34 @@ void panima::Channel::UpdateLookupCache()
 		static_cast<udm::ArrayLz4 *>(m_timesArray)->SetUncompressedMemoryPersistent(true);
 	if(m_valueArray->GetArrayType() == udm::ArrayType::Compressed)
 		static_cast<udm::ArrayLz4 *>(m_valueArray)->SetUncompressedMemoryPersistent(true);
+
+	InvalidateSampleInfo();
+}
+void panima::Channel::InvalidateSampleInfo()
+{
+	// The data may have changed, the sample info has to be updated explicitly
+	m_flatSegments.clear();
+	m_constant = false;
+	m_revision = get_next_revision();
+}
+const udm::Array &panima::Channel::GetTimesArray() const
+{
+	ResolveDeferredLoad();
+	return *m_timesArray;
+}
+const udm::Array &panima::Channel::GetValueArray() const
+{
+	ResolveDeferredLoad();
+	return *m_valueArray;
+}
+// The type doesn't require the array data, so deferred channels don't need to be resolved
+udm::Type panima::Channel::GetValueType() const { return m_valueArray->GetValueType(); }
+void panima::Channel::SetValueType(udm::Type type)
+{
+	if(!CheckMutable())
+		return;
+	GetValueArray().SetValueType(type);
 }
-udm::Array &panima::Channel::GetTimesArray() { return *m_timesArray; }
-udm::Array &panima::Channel::GetValueArray() { return *m_valueArray; }
-udm::Type panima::Channel::GetValueType() const { return GetValueArray().GetValueType(); }
-void panima::Channel::SetValueType(udm::Type type) { GetValueArray().SetValueType(type); }
 bool panima::Channel::Validate() const
 {
 	std::vector<float> times;
@@ -998,29 +1473,37 @@ void panima::Channel::TimeToLocalTimeFrame(float &inOutT) const
 std::pair<uint32_t, uint32_t> panima::Channel::FindInterpolationIndices(float t, float &interpFactor, uint32_t pivotIndex, uint32_t recursionDepth) const
 {
 	constexpr uint32_t MAX_RECURSION_DEPTH = 2;
-	auto &times = GetTimesArray();
-	if(pivotIndex >= times.GetSize() || times.GetSize() < 2 || recursionDepth == MAX_RECURSION_DEPTH)
+	ResolveDeferredLoad();
+	// The cached data pointer is used directly, which avoids going through the (possibly compressed) array
+	auto *times = m_timesData;
+	auto numTimes = m_timesArray->GetSize();
+	if(pivotIndex >= numTimes || numTimes < 2 || recursionDepth == MAX_RECURSION_DEPTH) {
+		instrumentation::increment(instrumentation::Counter::InterpolationCursorFallback);
 		return FindInterpolationIndices(t, interpFactor);
+	}
 	// We'll use the pivot index as the starting point of our search and check out the times immediately surrounding it.
 	// If we have a match, we can return immediately. If not, we'll slightly broaden the search until we've reached the max recursion depth or found a match.
 	// If we hit the max recusion depth, we'll just do a regular binary search instead.
-	auto tPivot = times.GetValue<float>(pivotIndex);
+	auto tPivot = times[pivotIndex];
 	auto tLocal = t;
 	TimeToLocalTimeFrame(tLocal);
 	if(tLocal >= tPivot) {
-		if(pivotIndex == times.GetSize() - 1) {
+		if(pivotIndex == numTimes - 1) {
+			instrumentation::increment(instrumentation::Counter::InterpolationCursorHit);
 			interpFactor = 0.f;
-			return {static_cast<uint32_t>(GetValueArray().GetSize() - 1), static_cast<uint32_t>(GetValueArray().GetSize() - 1)};
+			return {static_cast<uint32_t>(m_valueArray->GetSize() - 1), static_cast<uint32_t>(m_valueArray->GetSize() - 1)};
 		}
-		auto tPivotNext = times.GetValue<float>(pivotIndex + 1);
+		auto tPivotNext = times[pivotIndex + 1];
 		if(tLocal < tPivotNext) {
 			// Most common case
+			instrumentation::increment(instrumentation::Counter::InterpolationCursorHit);
 			interpFactor = (tLocal - tPivot) / (tPivotNext - tPivot);
 			return {pivotIndex, pivotIndex + 1};
 		}
 		return FindInterpolationIndices(t, interpFactor, pivotIndex + 1, recursionDepth + 1);
 	}
 	if(pivotIndex == 0) {
+		instrumentation::increment(instrumentation::Counter::InterpolationCursorHit);
 		interpFactor = 0.f;
 		return {0u, 0u};
 	}
@@ -1030,26 +1513,29 @@ std::pair<uint32_t, uint32_t> panima::Channel::FindInterpolationIndices(float t,
 
 std::pair<uint32_t, uint32_t> panima::Channel::FindInterpolationIndices(float t, float &interpFactor) const
 {
-	auto &times = GetTimesArray();
-	auto numTimes = times.GetSize();
+	ResolveDeferredLoad();
+	auto numTimes = m_timesArray->GetSize();
 	if(numTimes == 0) {
 		interpFactor = 0.f;
 		return {std::numeric_limits<uint32_t>::max(), std::numeric_limits<uint32_t>::max()};
 	}
 	// Binary search
+	instrumentation::increment(instrumentation::Counter::InterpolationBinarySearch);
 	TimeToLocalTimeFrame(t);
-	auto it = std::upper_bound(begin(times), end(times), t);
-	if(it == end(times)) {
+	const float *timesBegin = m_timesData;
+	auto *timesEnd = timesBegin + numTimes;
+	auto it = std::upper_bound(timesBegin, timesEnd, t);
+	if(it == timesEnd) {
 		interpFactor = 0.f;
 		return {static_cast<uint32_t>(numTimes - 1), static_cast<uint32_t>(numTimes - 1)};
 	}
-	if(it == begin(times)) {
+	if(it == timesBegin) {
 		interpFactor = 0.f;
 		return {0u, 0u};
 	}
 	auto itPrev = it - 1;
 	interpFactor = (t - *itPrev) / (*it - *itPrev);
-	return {static_cast<uint32_t>(itPrev - begin(times)), static_cast<uint32_t>(it - begin(times))};
+	return {static_cast<uint32_t>(itPrev - timesBegin), static_cast<uint32_t>(it - timesBegin)};
 }
 
 std::optional<size_t> panima::Channel::FindValueIndex(float time, float epsilon) const
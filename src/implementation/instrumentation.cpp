@@ -0,0 +1,155 @@
+// SPDX-FileCopyrightText: (c) 2025 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+module panima;
+
+import :instrumentation;
+
+namespace panima::instrumentation {
+	constexpr auto NUM_TIMERS = static_cast<size_t>(Timer::Count);
+	constexpr auto NUM_COUNTERS = static_cast<size_t>(Counter::Count);
+	// Only written to by the owning thread, the atomics are only used so that other threads can read the values
+	struct ThreadStorage {
+		struct AtomicTimerStats {
+			std::atomic<uint64_t> count = 0;
+			std::atomic<uint64_t> totalNs = 0;
+			std::atomic<uint64_t> maxNs = 0;
+		};
+		std::thread::id threadId {};
+		std::array<AtomicTimerStats, NUM_TIMERS> timers {};
+		std::array<std::atomic<uint64_t>, NUM_COUNTERS> counters {};
+	};
+	struct StatsRegistry {
+		std::mutex mutex;
+		std::vector<std::shared_ptr<ThreadStorage>> threads;
+	};
+	static StatsRegistry &get_registry()
+	{
+		static StatsRegistry registry;
+		return registry;
+	}
+	static ThreadStorage &get_thread_storage()
+	{
+		// The registry keeps the storage alive, so the stats of a thread are still available after it has exited
+		thread_local auto storage = [] {
+			auto storage = std::make_shared<ThreadStorage>();
+			storage->threadId = std::this_thread::get_id();
+			auto &registry = get_registry();
+			std::scoped_lock lock {registry.mutex};
+			registry.threads.push_back(storage);
+			return storage;
+		}();
+		return *storage;
+	}
+	static void add(std::atomic<uint64_t> &value, uint64_t n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+	static Stats to_stats(const ThreadStorage &storage)
+	{
+		Stats stats {};
+		for(auto i = decltype(NUM_TIMERS) {0u}; i < NUM_TIMERS; ++i) {
+			auto &src = storage.timers[i];
+			stats.timers[i] = {src.count.load(std::memory_order_relaxed), src.totalNs.load(std::memory_order_relaxed), src.maxNs.load(std::memory_order_relaxed)};
+		}
+		for(auto i = decltype(NUM_COUNTERS) {0u}; i < NUM_COUNTERS; ++i)
+			stats.counters[i] = storage.counters[i].load(std::memory_order_relaxed);
+		return stats;
+	}
+};
+
+panima::instrumentation::Stats &panima::instrumentation::Stats::operator+=(const Stats &other)
+{
+	for(auto i = decltype(timers.size()) {0u}; i < timers.size(); ++i) {
+		timers[i].count += other.timers[i].count;
+		timers[i].totalNs += other.timers[i].totalNs;
+		timers[i].maxNs = pragma::math::max(timers[i].maxNs, other.timers[i].maxNs);
+	}
+	for(auto i = decltype(counters.size()) {0u}; i < counters.size(); ++i)
+		counters[i] += other.counters[i];
+	return *this;
+}
+
+std::string_view panima::instrumentation::get_name(Timer timer)
+{
+	switch(timer) {
+	case Timer::PlayerAdvance:
+		return "PlayerAdvance";
+	case Timer::PoseSample:
+		return "PoseSample";
+	case Timer::BindingApply:
+		return "BindingApply";
+	case Timer::ExpressionApply:
+		return "ExpressionApply";
+	case Timer::AnimationLoad:
+		return "AnimationLoad";
+	case Timer::AnimationSave:
+		return "AnimationSave";
+	}
+	return "Unknown";
+}
+
+std::string_view panima::instrumentation::get_name(Counter counter)
+{
+	switch(counter) {
+	case Counter::ChannelSample:
+		return "ChannelSample";
+	case Counter::ChannelSampleSkipped:
+		return "ChannelSampleSkipped";
+	case Counter::InterpolationCursorHit:
+		return "InterpolationCursorHit";
+	case Counter::InterpolationCursorFallback:
+		return "InterpolationCursorFallback";
+	case Counter::InterpolationBinarySearch:
+		return "InterpolationBinarySearch";
+	case Counter::ArrayResize:
+		return "ArrayResize";
+	}
+	return "Unknown";
+}
+
+std::vector<panima::instrumentation::ThreadStats> panima::instrumentation::get_thread_stats()
+{
+	auto &registry = get_registry();
+	std::scoped_lock lock {registry.mutex};
+	std::vector<ThreadStats> stats;
+	stats.reserve(registry.threads.size());
+	for(auto &storage : registry.threads)
+		stats.push_back({storage->threadId, to_stats(*storage)});
+	return stats;
+}
+
+panima::instrumentation::Stats panima::instrumentation::get_stats()
+{
+	auto &registry = get_registry();
+	std::scoped_lock lock {registry.mutex};
+	Stats stats {};
+	for(auto &storage : registry.threads)
+		stats += to_stats(*storage);
+	return stats;
+}
+
+void panima::instrumentation::reset_stats()
+{
+	auto &registry = get_registry();
+	std::scoped_lock lock {registry.mutex};
+	for(auto &storage : registry.threads) {
+		for(auto &timer : storage->timers) {
+			timer.count.store(0, std::memory_order_relaxed);
+			timer.totalNs.store(0, std::memory_order_relaxed);
+			timer.maxNs.store(0, std::memory_order_relaxed);
+		}
+		for(auto &counter : storage->counters)
+			counter.store(0, std::memory_order_relaxed);
+	}
+}
+
+void panima::instrumentation::detail::record_time(Timer timer, uint64_t ns)
+{
+	auto &stats = get_thread_storage().timers[static_cast<size_t>(timer)];
+	add(stats.count, 1);
+	add(stats.totalNs, ns);
+	if(ns > stats.maxNs.load(std::memory_order_relaxed))
+		stats.maxNs.store(ns, std::memory_order_relaxed);
+}
+
+void panima::instrumentation::detail::increment(Counter counter, uint64_t n) { add(get_thread_storage().counters[static_cast<size_t>(counter)], n); }
@@ -8,31 +8,40 @@ module panima;
 import :player;
 import :animation;
 import :channel;
+import :instrumentation;
 
 std::shared_ptr<panima::Player> panima::Player::Create() { return std::shared_ptr<Player> {new Player {}}; }
 std::shared_ptr<panima::Player> panima::Player::Create(const Player &other) { return std::shared_ptr<Player> {new Player {other}}; }
 std::shared_ptr<panima::Player> panima::Player::Create(Player &&other) { return std::shared_ptr<Player> {new Player {std::move(other)}}; }
 panima::Player::Player() {}
 panima::Player::Player(const Player &other)
-    : m_playbackRate {other.m_playbackRate}, m_currentTime {other.m_currentTime}, m_stateFlags {other.m_stateFlags}, m_lastChannelTimestampIndices {other.m_lastChannelTimestampIndices}, m_animation {other.m_animation}, m_currentSlice {other.m_currentSlice}
+    : m_playbackRate {other.m_playbackRate}, m_currentTime {other.m_currentTime}, m_stateFlags {other.m_stateFlags}, m_previousTime {other.m_previousTime}, m_previousLoopCount {other.m_previousLoopCount}, m_lodPolicy {other.m_lodPolicy}, m_lodTick {other.m_lodTick}, m_lodFullUpdate {other.m_lodFullUpdate}, m_lastChannelTimestampIndices {other.m_lastChannelTimestampIndices}, m_animation {other.m_animation}, m_currentSlice {other.m_currentSlice},
+      m_triggeredEvents {other.m_triggeredEvents}
 {
-	static_assert(sizeof(*this) == 96, "Update this implementation when class has changed!");
+	static_assert(sizeof(*this) == 144, "Update this implementation when class has changed!");
 }
 panima::Player::Player(Player &&other)
-    : m_playbackRate {other.m_playbackRate}, m_currentTime {other.m_currentTime}, m_stateFlags {other.m_stateFlags}, m_lastChannelTimestampIndices {std::move(other.m_lastChannelTimestampIndices)}, m_animation {other.m_animation}, m_currentSlice {std::move(other.m_currentSlice)}
+    : m_playbackRate {other.m_playbackRate}, m_currentTime {other.m_currentTime}, m_stateFlags {other.m_stateFlags}, m_previousTime {other.m_previousTime}, m_previousLoopCount {other.m_previousLoopCount}, m_lodPolicy {other.m_lodPolicy}, m_lodTick {other.m_lodTick}, m_lodFullUpdate {other.m_lodFullUpdate}, m_lastChannelTimestampIndices {std::move(other.m_lastChannelTimestampIndices)}, m_animation {other.m_animation}, m_currentSlice {std::move(other.m_currentSlice)},
+      m_triggeredEvents {std::move(other.m_triggeredEvents)}
 {
-	static_assert(sizeof(*this) == 96, "Update this implementation when class has changed!");
+	static_assert(sizeof(*this) == 144, "Update this implementation when class has changed!");
 }
 panima::Player &panima::Player::operator=(const Player &other)
 {
 	m_playbackRate = other.m_playbackRate;
 	m_currentTime = other.m_currentTime;
 	m_stateFlags = other.m_stateFlags;
+	m_previousTime = other.m_previousTime;
+	m_previousLoopCount = other.m_previousLoopCount;
+	m_lodPolicy = other.m_lodPolicy;
+	m_lodTick = other.m_lodTick;
+	m_lodFullUpdate = other.m_lodFullUpdate;
 	m_animation = other.m_animation;
 	m_currentSlice = other.m_currentSlice;
 
 	m_lastChannelTimestampIndices = other.m_lastChannelTimestampIndices;
-	static_assert(sizeof(*this) == 96, "Update this implementation when class has changed!");
+	m_triggeredEvents = other.m_triggeredEvents;
+	static_assert(sizeof(*this) == 144, "Update this implementation when class has changed!");
 	return *this;
 }
 panima::Player &panima::Player::operator=(Player &&other)
@@ -40,11 +49,17 @@ panima::Player &panima::Player::operator=(Player &&other)
 	m_playbackRate = other.m_playbackRate;
 	m_currentTime = other.m_currentTime;
 	m_stateFlags = other.m_stateFlags;
+	m_previousTime = other.m_previousTime;
+	m_previousLoopCount = other.m_previousLoopCount;
+	m_lodPolicy = other.m_lodPolicy;
+	m_lodTick = other.m_lodTick;
+	m_lodFullUpdate = other.m_lodFullUpdate;
 	m_animation = other.m_animation;
 	m_currentSlice = std::move(other.m_currentSlice);
 
 	m_lastChannelTimestampIndices = std::move(other.m_lastChannelTimestampIndices);
-	static_assert(sizeof(*this) == 96, "Update this implementation when class has changed!");
+	m_triggeredEvents = std::move(other.m_triggeredEvents);
+	static_assert(sizeof(*this) == 144, "Update this implementation when class has changed!");
 	return *this;
 }
 float panima::Player::GetDuration() const
@@ -66,35 +81,135 @@ void panima::Player::SetCurrentTime(float t, bool updateAnimation)
 	if(t == m_currentTime)
 		return;
 	m_currentTime = t;
+	m_stateFlags |= StateFlags::ForceSample;
+	// Jumps don't produce any root motion
+	m_previousTime = t;
+	m_previousLoopCount = 0;
+	// Events at the new time haven't been triggered yet
+	m_stateFlags |= StateFlags::IncludeStartEvents;
 	if(updateAnimation == false) {
 		m_stateFlags |= StateFlags::AnimationDirty;
 		return;
 	}
 	Advance(0.f, true);
 }
-void panima::Player::SetAnimationDirty() { pragma::math::set_flag(m_stateFlags, StateFlags::AnimationDirty, true); }
+void panima::Player::SetAnimationDirty() { m_stateFlags |= StateFlags::AnimationDirty | StateFlags::ForceSample; }
+void panima::Player::SetLodPolicy(const LodPolicy &policy)
+{
+	m_lodPolicy = policy;
+	m_lodTick = policy.phase;
+	m_stateFlags |= StateFlags::ForceSample;
+}
 void panima::Player::SetLooping(bool looping) { pragma::math::set_flag(m_stateFlags, StateFlags::Looping, looping); }
 bool panima::Player::IsLooping() const { return pragma::math::is_flag_set(m_stateFlags, StateFlags::Looping); }
+static void collect_events(const panima::Animation &anim, float tStart, float tEnd, bool includeStart, bool includeEnd, bool reverse, std::vector<panima::Player::TriggeredEvent> &outEvents)
+{
+	auto offset = outEvents.size();
+	auto &tracks = anim.GetEventTracks();
+	for(auto trackIdx = decltype(tracks.size()) {0u}; trackIdx < tracks.size(); ++trackIdx) {
+		auto [first, last] = tracks[trackIdx].FindEvents(tStart, tEnd, includeStart, includeEnd);
+		for(auto i = first; i < last; ++i)
+			outEvents.push_back({static_cast<uint32_t>(trackIdx), i});
+	}
+	auto itBegin = outEvents.begin() + offset;
+	if(tracks.size() > 1) {
+		// Events at the same time are ordered by track and event index, which makes the order unique, so the
+		// non-allocating std::sort can be used instead of std::stable_sort
+		std::sort(itBegin, outEvents.end(), [&tracks](const panima::Player::TriggeredEvent &a, const panima::Player::TriggeredEvent &b) {
+			auto ta = tracks[a.trackIndex].GetEvents()[a.eventIndex].time;
+			auto tb = tracks[b.trackIndex].GetEvents()[b.eventIndex].time;
+			if(ta != tb)
+				return ta < tb;
+			if(a.trackIndex != b.trackIndex)
+				return a.trackIndex < b.trackIndex;
+			return a.eventIndex < b.eventIndex;
+		});
+	}
+	if(reverse)
+		std::reverse(itBegin, outEvents.end());
+}
+
 bool panima::Player::Advance(float dt, bool forceUpdate)
 {
+	instrumentation::ScopedTimer timer {instrumentation::Timer::PlayerAdvance};
 	if(!m_animation)
 		return false;
 	auto &anim = m_animation;
+	++m_lodTick;
+	m_lodFullUpdate = pragma::math::is_flag_set(m_stateFlags, StateFlags::ForceSample);
+	if(m_lodFullUpdate) {
+		// Restart the update interval, so that this update is sampled
+		m_lodTick -= GetLodUpdateIndex();
+		pragma::math::set_flag(m_stateFlags, StateFlags::ForceSample, false);
+	}
 	dt *= m_playbackRate;
 	auto newTime = m_currentTime;
 	newTime += dt;
 	auto dur = anim->GetDuration();
+	auto looping = pragma::math::is_flag_set(m_stateFlags, StateFlags::Looping) && dur > 0.f;
+	uint32_t numWraps = 0;
 	if(newTime > dur) {
-		if(pragma::math::is_flag_set(m_stateFlags, StateFlags::Looping) && dur > 0.f) {
+		if(looping) {
+			// The difference is an exact multiple of the duration, so the number of wraps is not affected by rounding
 			auto d = fmodf(newTime, dur);
+			numWraps = static_cast<uint32_t>(std::floor((newTime - d) / dur + 0.5f));
 			newTime = d;
 		}
 		// else
 		// 	newTime = dur;
 	}
-	if(newTime == m_currentTime && !forceUpdate && !pragma::math::is_flag_set(m_stateFlags, StateFlags::AnimationDirty))
+	else if(newTime < 0.f && looping) {
+		// Negative playback rate
+		auto d = fmodf(newTime, dur); // (-dur, 0]
+		numWraps = static_cast<uint32_t>(std::floor((d - newTime) / dur + 0.5f));
+		if(d < 0.f) {
+			// Wrapped past the start of the current loop
+			++numWraps;
+			newTime = pragma::math::clamp(d + dur, 0.f, dur);
+		}
+		else
+			newTime = 0.f; // Landed exactly on the start of a loop, which doesn't wrap into the previous one
+	}
+	if(newTime == m_currentTime && !forceUpdate && !pragma::math::is_flag_set(m_stateFlags, StateFlags::AnimationDirty)) {
+		m_previousTime = m_currentTime;
+		m_previousLoopCount = 0;
 		return false;
+	}
 	pragma::math::set_flag(m_stateFlags, StateFlags::AnimationDirty, false);
+
+	m_triggeredEvents.clear();
+	if(dt != 0.f && !anim->GetEventTracks().empty()) {
+		auto includeStart = pragma::math::is_flag_set(m_stateFlags, StateFlags::IncludeStartEvents);
+		auto prevTime = m_currentTime;
+		if(dt > 0.f) {
+			if(numWraps == 0)
+				collect_events(*anim, prevTime, newTime, includeStart, true, false, m_triggeredEvents);
+			else {
+				collect_events(*anim, prevTime, dur, includeStart, true, false, m_triggeredEvents);
+				// If we skipped over entire loops, the events of the full animation are only reported once,
+				// so the remaining range is the part of the animation that hasn't been reported yet
+				if(numWraps > 1)
+					collect_events(*anim, 0.f, prevTime, true, !includeStart, false, m_triggeredEvents);
+				else
+					collect_events(*anim, 0.f, newTime, true, true, false, m_triggeredEvents);
+			}
+		}
+		else {
+			if(numWraps == 0)
+				collect_events(*anim, newTime, prevTime, true, includeStart, true, m_triggeredEvents);
+			else {
+				collect_events(*anim, 0.f, prevTime, true, includeStart, true, m_triggeredEvents);
+				if(numWraps > 1)
+					collect_events(*anim, prevTime, dur, !includeStart, true, true, m_triggeredEvents);
+				else
+					collect_events(*anim, newTime, dur, true, true, true, m_triggeredEvents);
+			}
+		}
+		pragma::math::set_flag(m_stateFlags, StateFlags::IncludeStartEvents, false);
+	}
+
+	m_previousTime = m_currentTime;
+	m_previousLoopCount = (dt < 0.f) ? -static_cast<int32_t>(numWraps) : static_cast<int32_t>(numWraps);
 	m_currentTime = newTime;
 	return true;
 	/*auto &channels = anim->GetChannels();
@@ -122,21 +237,69 @@ bool panima::Player::Advance(float dt, bool forceUpdate)
 	// ApplySliceInterpolation(m_prevAnimSlice,m_currentSlice,fadeFactor);
 }
 
+pragma::math::Transform panima::Player::GetRootMotionDelta() const
+{
+	auto *rootMotion = m_animation ? m_animation->GetRootMotion() : nullptr;
+	if(!rootMotion)
+		return {};
+	if(m_previousLoopCount == 0)
+		return rootMotion->GetDelta(m_previousTime, m_currentTime);
+	auto dur = rootMotion->duration;
+	auto forward = m_previousLoopCount > 0;
+	auto delta = forward ? rootMotion->GetDelta(m_previousTime, dur) : rootMotion->GetDelta(m_previousTime, 0.f);
+	auto numFullLoops = static_cast<uint32_t>(std::abs(m_previousLoopCount) - 1);
+	if(numFullLoops > 0) {
+		// Exponentiation by squaring, all factors are powers of the same transform, so the order doesn't matter
+		auto loopDelta = forward ? rootMotion->GetDelta(0.f, dur) : rootMotion->GetDelta(dur, 0.f);
+		pragma::math::Transform loopsDelta {};
+		for(auto n = numFullLoops; n > 0; n >>= 1) {
+			if(n & 1)
+				loopsDelta = loopsDelta * loopDelta;
+			loopDelta = loopDelta * loopDelta;
+		}
+		delta = delta * loopsDelta;
+	}
+	return delta * (forward ? rootMotion->GetDelta(0.f, m_currentTime) : rootMotion->GetDelta(dur, m_currentTime));
+}
+
+size_t panima::Player::GetMemoryUsage() const
+{
+	auto size = sizeof(*this) + m_lastChannelTimestampIndices.capacity() * sizeof(uint32_t) + m_triggeredEvents.capacity() * sizeof(TriggeredEvent);
+	size += m_currentSlice.channelValues.capacity() * sizeof(udm::PProperty);
+	for(auto &prop : m_currentSlice.channelValues) {
+		if(prop)
+			size += sizeof(udm::Property) + udm::size_of_base_type(prop->type);
+	}
+	return size;
+}
+
 void panima::Player::SetAnimation(const Animation &animation)
 {
 	Reset();
 	m_animation = animation.shared_from_this();
 	auto &channels = animation.GetChannels();
-	m_currentSlice.channelValues.reserve(channels.size());
-	for(auto &channel : channels)
-		m_currentSlice.channelValues.push_back(udm::Property::Create(channel->GetValueType()));
+	// Existing properties are re-used if their type matches and they're not shared with a copy of this player,
+	// so switching between animations with the same channel layout doesn't allocate
+	auto &channelValues = m_currentSlice.channelValues;
+	channelValues.resize(channels.size());
+	for(auto i = decltype(channels.size()) {0u}; i < channels.size(); ++i) {
+		auto type = channels[i]->GetValueType();
+		auto &prop = channelValues[i];
+		if(!prop || prop->type != type || prop.use_count() > 1)
+			prop = udm::Property::Create(type);
+	}
 	m_lastChannelTimestampIndices.resize(channels.size(), std::numeric_limits<uint32_t>::max());
 }
 
 void panima::Player::Reset()
 {
 	m_currentTime = 0.f;
-	m_lastChannelTimestampIndices.clear();
+	m_previousTime = 0.f;
+	m_previousLoopCount = 0;
+	m_triggeredEvents.clear();
+	m_stateFlags |= StateFlags::IncludeStartEvents | StateFlags::ForceSample;
+	// Indices are reset rather than cleared, so they remain accessible by channel index
+	std::fill(m_lastChannelTimestampIndices.begin(), m_lastChannelTimestampIndices.end(), std::numeric_limits<uint32_t>::max());
 }
 void panima::Player::ApplySliceInterpolation(const Slice &src, Slice &dst, float f)
 {
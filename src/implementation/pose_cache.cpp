@@ -0,0 +1,107 @@
+// SPDX-FileCopyrightText: (c) 2025 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+module panima;
+
+import :pose_cache;
+import :animation;
+
+size_t panima::PoseCache::KeyHash::operator()(const Key &key) const { return std::hash<const Animation *> {}(key.animation) ^ (std::hash<int64_t> {}(key.timeKey) * 0x9e3779b97f4a7c15ull); }
+
+panima::PoseCache::PoseCache(uint32_t capacity, float timeQuantization) : m_capacity {capacity}, m_timeQuantization {timeQuantization} {}
+
+void panima::PoseCache::SetCapacity(uint32_t capacity)
+{
+	m_capacity = capacity;
+	while(m_entries.size() > m_capacity)
+		Erase(std::prev(m_entries.end()));
+}
+
+void panima::PoseCache::SetTimeQuantization(float quantization)
+{
+	if(quantization == m_timeQuantization)
+		return;
+	m_timeQuantization = quantization;
+	Clear();
+}
+
+int64_t panima::PoseCache::GetTimeKey(float t) const
+{
+	if(m_timeQuantization <= 0.f)
+		return std::bit_cast<int32_t>(t);
+	return std::llround(t / m_timeQuantization);
+}
+
+float panima::PoseCache::GetQuantizedTime(float t) const
+{
+	if(m_timeQuantization <= 0.f)
+		return t;
+	return static_cast<float>(GetTimeKey(t)) * m_timeQuantization;
+}
+
+void panima::PoseCache::Erase(std::list<Entry>::iterator it)
+{
+	m_lookup.erase(it->key);
+	m_entries.erase(it);
+}
+
+const panima::PoseCache::CachedPose *panima::PoseCache::Find(const Animation &anim, float t)
+{
+	auto it = m_lookup.find(Key {&anim, GetTimeKey(t)});
+	if(it == m_lookup.end()) {
+		++m_missCount;
+		return nullptr;
+	}
+	auto itEntry = it->second;
+	// The animation may have been destroyed and another one created at the same address
+	if(itEntry->animation.lock().get() != &anim || itEntry->revision != anim.GetRevision()) {
+		Erase(itEntry);
+		++m_missCount;
+		return nullptr;
+	}
+	m_entries.splice(m_entries.begin(), m_entries, itEntry);
+	++m_hitCount;
+	return &itEntry->pose;
+}
+
+void panima::PoseCache::Insert(const Animation &anim, float t, const Pose &pose, std::vector<uint32_t> timestampIndices)
+{
+	if(m_capacity == 0)
+		return;
+	Key key {&anim, GetTimeKey(t)};
+	auto it = m_lookup.find(key);
+	if(it != m_lookup.end())
+		Erase(it->second);
+	while(m_entries.size() >= m_capacity)
+		Erase(std::prev(m_entries.end()));
+	m_entries.push_front({key, anim.shared_from_this(), anim.GetRevision(), {pose, std::move(timestampIndices)}});
+	m_lookup[key] = m_entries.begin();
+}
+
+void panima::PoseCache::Invalidate(const Animation &anim)
+{
+	for(auto it = m_entries.begin(); it != m_entries.end();) {
+		auto itNext = std::next(it);
+		if(it->key.animation == &anim)
+			Erase(it);
+		it = itNext;
+	}
+}
+
+size_t panima::PoseCache::GetMemoryUsage() const
+{
+	auto size = sizeof(*this) + get_hash_map_memory_usage(m_lookup);
+	for(auto &entry : m_entries) {
+		size += sizeof(entry) + sizeof(void *) * 2 + entry.pose.timestampIndices.capacity() * sizeof(uint32_t);
+		size += entry.pose.pose.GetMemoryUsage();
+	}
+	return size;
+}
+
+void panima::PoseCache::Clear()
+{
+	m_entries.clear();
+	m_lookup.clear();
+}
@@ -12,12 +12,38 @@ import :expression;
 static constexpr auto VALUE_EPSILON = 0.001f;
 
 panima::expression::ExprScalar panima::expression::ExprFuncPerlinNoise::operator()(const ExprScalar &v1, const ExprScalar &v2, const ExprScalar &v3) { return m_noise.GetNoise(v1, v2, v3); }
+template<typename T>
+static void write_value_components(const T &value, panima::expression::ExprScalar *out, uint32_t n)
+{
+	auto *ptrValue = reinterpret_cast<const udm::underlying_numeric_type<T> *>(&value);
+	for(auto i = decltype(n) {0u}; i < n; ++i)
+		out[i] = static_cast<panima::expression::ExprScalar>(ptrValue[i]);
+}
+
+template<typename T>
+static const std::array<panima::expression::ExprScalar, 16> &get_value_at(panima::expression::EvaluationContext &context, panima::expression::ExprScalar t)
+{
+	auto &cache = context.valueAtCache;
+	for(auto i = decltype(cache.count) {0u}; i < cache.count; ++i) {
+		if(cache.times[i] == t)
+			return cache.values[i];
+	}
+	// The pivot is shared between all lookups of this evaluation, so that
+	// neighboring samples don't have to search from the evaluated time index again
+	auto value = context.channel->GetInterpolatedValue<T>(t, cache.pivot);
+	auto idx = cache.next;
+	cache.next = (cache.next + 1) % cache.SIZE;
+	cache.count = pragma::math::min(cache.count + 1, cache.SIZE);
+	cache.times[idx] = t;
+	write_value_components(value, cache.values[idx].data(), udm::get_numeric_component_count(udm::type_to_enum<T>()));
+	return cache.values[idx];
+}
+
 template<typename T>
 panima::expression::ExprScalar panima::expression::ExprFuncValueAtArithmetic<T>::operator()(const ExprScalar &v)
 {
-	assert(m_valueExpression);
-	uint32_t pivotIndex = m_valueExpression->expr.timeIndex;
-	return m_valueExpression->channel.GetInterpolatedValue<T>(v, pivotIndex);
+	assert(m_context);
+	return get_value_at<T>(*m_context, v)[0];
 }
 
 template<typename T>
@@ -27,22 +53,40 @@ panima::expression::ExprScalar panima::expression::ExprFuncValueAtVector<T>::ope
 	assert(parameters.size() == 2);
 	typename generic_type::scalar_view t {parameters[0]};
 	typename generic_type::vector_view out {parameters[1]};
-	assert(m_valueExpression);
-	uint32_t pivotIndex = m_valueExpression->expr.timeIndex;
+	assert(m_context);
 	auto n = udm::get_numeric_component_count(udm::type_to_enum<T>());
 	assert(out.size() == n);
-	if constexpr(std::is_same_v<udm::underlying_numeric_type<T>, ExprScalar>)
-		*reinterpret_cast<T *>(&out[0]) = m_valueExpression->channel.GetInterpolatedValue<T>(t(), pivotIndex);
-	else {
-		auto value = m_valueExpression->channel.GetInterpolatedValue<T>(t(), pivotIndex);
-		auto *ptrValue = reinterpret_cast<udm::underlying_numeric_type<T> *>(&value);
-		auto *ptrOut = &out[0];
-		for(auto i = decltype(n) {0u}; i < n; ++i)
-			ptrOut[i] = ptrValue[i];
-	}
+	auto &value = get_value_at<T>(*m_context, t());
+	auto *ptrOut = &out[0];
+	for(auto i = decltype(n) {0u}; i < n; ++i)
+		ptrOut[i] = value[i];
 	return {};
 }
 
+template<typename T>
+panima::expression::ExprScalar panima::expression::ExprFuncValueRange<T>::operator()(parameter_list_t parameters)
+{
+	using generic_type = generic_type;
+	assert(parameters.size() == 3);
+	typename generic_type::scalar_view tStart {parameters[0]};
+	typename generic_type::scalar_view tEnd {parameters[1]};
+	typename generic_type::vector_view out {parameters[2]};
+	assert(m_context);
+	auto n = udm::get_numeric_component_count(udm::type_to_enum<T>());
+	auto numSamples = out.size() / n;
+	if(numSamples == 0)
+		return 0;
+	// Samples are in ascending order, so the shared cursor of the value_at cache is enough to walk the keyframes
+	auto *ptrOut = &out[0];
+	auto dt = (numSamples > 1) ? (tEnd() - tStart()) / static_cast<ExprScalar>(numSamples - 1) : ExprScalar {0};
+	for(auto i = decltype(numSamples) {0u}; i < numSamples; ++i) {
+		auto t = tStart() + dt * static_cast<ExprScalar>(i);
+		auto &value = get_value_at<T>(*m_context, t);
+		std::copy_n(value.begin(), n, ptrOut + i * n);
+	}
+	return static_cast<ExprScalar>(numSamples);
+}
+
 static panima::expression::ExprScalar ramp(const panima::expression::ExprScalar &x, const panima::expression::ExprScalar &a, const panima::expression::ExprScalar &b)
 {
 	if(a == b)
@@ -84,15 +128,10 @@ namespace panima::expression {
 		return ExprScalar {};
 	}
 
-	extern exprtk::symbol_table<ExprScalar> &get_quaternion_symbol_table();
-	static exprtk::symbol_table<ExprScalar> &get_base_symbol_table()
+	extern exprtk::symbol_table<ExprScalar> create_quaternion_symbol_table();
+	static exprtk::symbol_table<ExprScalar> create_base_symbol_table()
 	{
-		static exprtk::symbol_table<ExprScalar> symTable;
-		static auto initialized = false;
-		if(initialized)
-			return symTable;
-		initialized = true;
-
+		exprtk::symbol_table<ExprScalar> symTable;
 		static ExprFuncGeneric1Param<ExprScalar, sqr> f_sqr {};
 		static ExprFuncGeneric3Param<ExprScalar, ramp> f_ramp {};
 		static ExprFuncGeneric3Param<ExprScalar, cramp> f_cramp {};
@@ -124,9 +163,110 @@ namespace panima::expression {
 	}
 };
 
-bool panima::expression::ValueExpression::Initialize(udm::Type type, std::string &outErr)
+// exprtk reference-counts symbol tables without synchronization, and a parser keeps references to the tables of the
+// last expression it compiled. The built-in tables are built once per thread, together with a parser, and every
+// operation that copies or releases references to them (compiling or destroying a context) is serialized through the
+// mutex of the set. Contexts are usually destroyed on the thread that created them, so the mutex is rarely contended.
+struct panima::expression::SymbolTableSet {
+	std::mutex mutex;
+	exprtk::symbol_table<ExprScalar> baseSymbolTable = create_base_symbol_table();
+	exprtk::symbol_table<ExprScalar> quaternionSymbolTable = create_quaternion_symbol_table();
+	exprtk::parser<ExprScalar> parser;
+};
+
+static const std::shared_ptr<panima::expression::SymbolTableSet> &get_symbol_table_set()
+{
+	// Kept alive by the contexts using it after the thread has ended
+	thread_local auto set = std::make_shared<panima::expression::SymbolTableSet>();
+	return set;
+}
+
+panima::expression::EvaluationContext::~EvaluationContext()
+{
+	if(!symbolTableSet)
+		return;
+	// Release all references to the shared tables while holding the lock
+	std::scoped_lock lock {symbolTableSet->mutex};
+	expression = {};
+	symbolTable = {};
+}
+
+static panima::expression::ExpressionFlags get_symbol_flags(std::string symbol)
+{
+	using panima::expression::ExpressionFlags;
+	// Symbol names are case-insensitive in exprtk
+	pragma::string::to_lower(symbol);
+	if(symbol == "time")
+		return ExpressionFlags::UsesTime;
+	if(symbol == "timeindex")
+		return ExpressionFlags::UsesTimeIndex;
+	if(symbol == "startoffset" || symbol == "timescale" || symbol == "duration")
+		return ExpressionFlags::UsesTimeFrame;
+	if(symbol == "value")
+		return ExpressionFlags::UsesValue;
+	if(symbol == "value_at" || symbol == "value_range")
+		return ExpressionFlags::UsesValueAt;
+	if(symbol == "noise" || symbol == "print")
+		return ExpressionFlags::Impure;
+	return ExpressionFlags::None;
+}
+
+std::shared_ptr<panima::expression::CompiledExpression> panima::expression::CompiledExpression::Compile(std::string expression, udm::Type type, std::string &outErr)
+{
+	auto compiledExpression = std::shared_ptr<CompiledExpression> {new CompiledExpression {}};
+	auto &program = compiledExpression->m_program;
+	program.expression = std::move(expression);
+	program.type = type;
+	program.noiseSeed = static_cast<uint32_t>(pragma::math::random(std::numeric_limits<int>::lowest(), std::numeric_limits<int>::max()));
+
+	std::vector<std::string> symbols;
+	auto context = compiledExpression->CreateContext(outErr, &symbols);
+	if(!context)
+		return nullptr;
+	for(auto &symbol : symbols)
+		program.flags |= get_symbol_flags(symbol);
+	if((program.flags & (ExpressionFlags::UsesTime | ExpressionFlags::UsesTimeIndex | ExpressionFlags::UsesTimeFrame | ExpressionFlags::UsesValue | ExpressionFlags::UsesValueAt | ExpressionFlags::Impure)) == ExpressionFlags::None) {
+		// Expression doesn't depend on any input, so we can fold it into a constant
+		EvaluationResult result;
+		compiledExpression->Evaluate(*context, result);
+		program.constantResult = result;
+		program.flags |= ExpressionFlags::Constant;
+	}
+	compiledExpression->m_primaryContext = context.get();
+	compiledExpression->m_contexts.push_back(std::move(context));
+	return compiledExpression;
+}
+
+panima::expression::CompiledExpression::~CompiledExpression()
+{
+	m_primaryContext = nullptr;
+	m_freeContexts.clear();
+	m_contexts.clear();
+}
+
+void panima::expression::CompiledExpression::Evaluate(EvaluationContext &context, EvaluationResult &outResult) const
+{
+	using type_t = exprtk::results_context<ExprScalar>::type_store_t;
+	outResult.scalar = context.expression.value();
+	auto &results = context.expression.results();
+	if(results.count() == 1 && results[0].type == type_t::e_vector) {
+		typename type_t::vector_view vv {results[0]};
+		outResult.isVector = true;
+		outResult.size = vv.size();
+		auto n = pragma::math::min(vv.size(), outResult.values.size());
+		for(auto i = decltype(n) {0u}; i < n; ++i)
+			outResult.values[i] = vv[i];
+	}
+	else
+		outResult.isVector = false;
+}
+
+std::unique_ptr<panima::expression::EvaluationContext> panima::expression::CompiledExpression::CreateContext(std::string &outErr, std::vector<std::string> *optOutSymbols) const
 {
-	auto success = udm::visit_ng(type, [this](auto tag) {
+	auto context = std::make_unique<EvaluationContext>(m_program.noiseSeed);
+	auto &expr = *context;
+	auto type = m_program.type;
+	auto success = udm::visit_ng(type, [&expr](auto tag) {
 		using T = typename decltype(tag)::type;
 		if constexpr(!is_supported_expression_type_v<T>)
 			return false;
@@ -150,14 +290,17 @@ bool panima::expression::ValueExpression::Initialize(udm::Type type, std::string
 				expr.symbolTable.add_function("value_at", *valueAt);
 				expr.f_valueAt = std::move(valueAt);
 			}
+
+			auto valueRange = std::make_unique<ExprFuncValueRange<T>>();
+			expr.symbolTable.add_function("value_range", *valueRange);
+			expr.f_valueRange = std::move(valueRange);
 			return true;
 		}
 	});
 	if(!success) {
 		outErr = "Unsupported type '" + std::string {magic_enum::enum_name(type)} + "'!";
-		return false;
+		return nullptr;
 	}
-	m_type = type;
 
 	expr.symbolTable.add_variable("time", expr.time);
 	expr.symbolTable.add_variable("timeIndex", expr.timeIndex);
@@ -167,26 +310,154 @@ bool panima::expression::ValueExpression::Initialize(udm::Type type, std::string
 	expr.symbolTable.add_variable("duration", expr.duration);
 
 	assert(expr.f_valueAt != nullptr);
-	expr.f_valueAt->SetValueExpression(*this);
+	expr.f_valueAt->SetContext(expr);
+	expr.f_valueRange->SetContext(expr);
 
 	expr.symbolTable.add_function("noise", expr.f_perlinNoise);
 
-	expr.expression.register_symbol_table(get_base_symbol_table());
-	expr.expression.register_symbol_table(get_quaternion_symbol_table());
+	expr.symbolTableSet = get_symbol_table_set();
+	std::scoped_lock lock {expr.symbolTableSet->mutex};
+	expr.expression.register_symbol_table(expr.symbolTableSet->baseSymbolTable);
+	expr.expression.register_symbol_table(expr.symbolTableSet->quaternionSymbolTable);
 	expr.expression.register_symbol_table(expr.symbolTable);
-	if(expr.parser.compile(expression, expr.expression) == false) {
-		outErr = expr.parser.error();
-		return false;
+	auto &parser = expr.symbolTableSet->parser;
+	parser.dec().collect_variables() = (optOutSymbols != nullptr);
+	parser.dec().collect_functions() = (optOutSymbols != nullptr);
+	if(parser.compile(m_program.expression, expr.expression) == false) {
+		outErr = parser.error();
+		return nullptr;
 	}
-	return true;
+	if(optOutSymbols) {
+		std::deque<exprtk::parser<ExprScalar>::dependent_entity_collector::symbol_t> symbols;
+		parser.dec().symbols(symbols);
+		optOutSymbols->reserve(symbols.size());
+		for(auto &symbol : symbols)
+			optOutSymbols->push_back(symbol.first);
+	}
+	return context;
 }
 
-panima::expression::ValueExpression::ValueExpression(const ValueExpression &other) : ValueExpression {other.channel}
+panima::expression::EvaluationContext *panima::expression::CompiledExpression::AcquireContext()
 {
-	expression = other.expression;
-	m_type = other.m_type;
+	if(m_primaryContext && !m_primaryContextInUse.exchange(true, std::memory_order_acquire))
+		return m_primaryContext;
+	{
+		std::scoped_lock lock {m_contextMutex};
+		if(!m_freeContexts.empty()) {
+			auto *context = m_freeContexts.back();
+			m_freeContexts.pop_back();
+			return context;
+		}
+	}
+	// Another thread is evaluating this expression, we'll need a new context
 	std::string err;
-	Initialize(other.m_type, err);
+	auto context = CreateContext(err);
+	if(!context)
+		return nullptr;
+	auto *ptr = context.get();
+	std::scoped_lock lock {m_contextMutex};
+	m_contexts.push_back(std::move(context));
+	return ptr;
+}
+
+void panima::expression::CompiledExpression::ReleaseContext(EvaluationContext &context)
+{
+	if(&context == m_primaryContext) {
+		m_primaryContextInUse.store(false, std::memory_order_release);
+		return;
+	}
+	std::scoped_lock lock {m_contextMutex};
+	m_freeContexts.push_back(&context);
+}
+
+namespace panima::expression {
+	struct CompiledExpressionKey {
+		std::string expression;
+		udm::Type type;
+		bool operator==(const CompiledExpressionKey &other) const { return type == other.type && expression == other.expression; }
+	};
+	struct CompiledExpressionKeyHash {
+		size_t operator()(const CompiledExpressionKey &key) const
+		{
+			auto hash = std::hash<std::string> {}(key.expression);
+			return hash ^ (std::hash<std::underlying_type_t<udm::Type>> {}(static_cast<std::underlying_type_t<udm::Type>>(key.type)) + 0x9e3779b9 + (hash << 6) + (hash >> 2));
+		}
+	};
+	struct CompiledExpressionCache {
+		std::unordered_map<CompiledExpressionKey, std::weak_ptr<CompiledExpression>, CompiledExpressionKeyHash> entries;
+		std::mutex mutex;
+	};
+	static CompiledExpressionCache &get_compiled_expression_cache()
+	{
+		static CompiledExpressionCache cache;
+		return cache;
+	}
+};
+
+std::shared_ptr<panima::expression::CompiledExpression> panima::expression::get_compiled_expression(const std::string &expression, udm::Type type, std::string &outErr)
+{
+	auto &cache = get_compiled_expression_cache();
+	CompiledExpressionKey key {expression, type};
+	{
+		std::scoped_lock lock {cache.mutex};
+		auto it = cache.entries.find(key);
+		if(it != cache.entries.end()) {
+			auto compiledExpression = it->second.lock();
+			if(compiledExpression)
+				return compiledExpression;
+			cache.entries.erase(it);
+		}
+	}
+	// Note: The expression is compiled without holding the cache lock. If multiple threads compile the same
+	// expression at the same time, the last one will end up in the cache, which is harmless.
+	auto compiledExpression = CompiledExpression::Compile(expression, type, outErr);
+	if(!compiledExpression)
+		return nullptr;
+	if((compiledExpression->GetProgram().flags & ExpressionFlags::Impure) != ExpressionFlags::None)
+		return compiledExpression; // Each channel gets its own noise seed, so impure expressions can't be shared
+
+	std::scoped_lock lock {cache.mutex};
+	// Clear out expired entries from time to time to prevent the cache from growing indefinitely
+	auto numEntries = cache.entries.size();
+	if(numEntries >= 256 && (numEntries & (numEntries - 1)) == 0) {
+		for(auto it = cache.entries.begin(); it != cache.entries.end();) {
+			if(it->second.expired())
+				it = cache.entries.erase(it);
+			else
+				++it;
+		}
+	}
+	cache.entries[std::move(key)] = compiledExpression;
+	return compiledExpression;
+}
+
+bool panima::expression::ValueExpression::Initialize(udm::Type type, std::string &outErr)
+{
+	m_compiledExpression = get_compiled_expression(expression, type, outErr);
+	return m_compiledExpression != nullptr;
+}
+
+panima::expression::ExpressionFlags panima::expression::ValueExpression::GetFlags() const { return m_compiledExpression ? m_compiledExpression->GetProgram().flags : ExpressionFlags::None; }
+size_t panima::expression::CompiledExpression::GetMemoryUsage() const
+{
+	auto size = sizeof(*this) + m_program.expression.capacity();
+	std::scoped_lock lock {m_contextMutex};
+	size += m_contexts.size() * sizeof(EvaluationContext) + m_contexts.capacity() * sizeof(m_contexts.front()) + m_freeContexts.capacity() * sizeof(EvaluationContext *);
+	return size;
 }
+size_t panima::expression::ValueExpression::GetMemoryUsage() const
+{
+	auto size = sizeof(*this) + expression.capacity();
+	if(m_compiledExpression)
+		size += m_compiledExpression->GetMemoryUsage() / static_cast<size_t>(pragma::math::max(m_compiledExpression.use_count(), 1l));
+	return size;
+}
+bool panima::expression::ValueExpression::IsConstant() const { return m_compiledExpression && m_compiledExpression->GetProgram().constantResult.has_value(); }
+bool panima::expression::ValueExpression::IsValueIndependent() const
+{
+	return m_compiledExpression && (m_compiledExpression->GetProgram().flags & (ExpressionFlags::UsesValue | ExpressionFlags::UsesValueAt | ExpressionFlags::Impure)) == ExpressionFlags::None;
+}
+
+panima::expression::ValueExpression::ValueExpression(Channel &channel, const ValueExpression &other) : channel {channel}, expression {other.expression}, m_compiledExpression {other.m_compiledExpression} {}
 
-panima::expression::ValueExpression::~ValueExpression() { expr.f_valueAt = nullptr; }
+panima::expression::ValueExpression::ValueExpression(const ValueExpression &other) : ValueExpression {other.channel, other} {}
@@ -226,13 +226,10 @@ namespace panima::expression {
 		return uquat::length(q);
 	}
 
-	exprtk::symbol_table<ExprScalar> &get_quaternion_symbol_table()
+	// Function objects are stateless and shared, the table itself is created once per thread (see SymbolTableSet)
+	exprtk::symbol_table<ExprScalar> create_quaternion_symbol_table()
 	{
-		static exprtk::symbol_table<ExprScalar> symTable;
-		static auto initialized = false;
-		if(initialized)
-			return symTable;
-		initialized = true;
+		exprtk::symbol_table<ExprScalar> symTable;
 
 		static_assert(std::is_same_v<ExprScalar, Quat::value_type> && std::is_same_v<ExprScalar, ::Vector3::value_type>);
 		static ExprFuncGeneric<ExprScalar, q_from_axis_angle> f_q_from_axis_angle {};
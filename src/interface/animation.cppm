@@ -10,24 +10,117 @@ export module panima:animation;
 import :channel;
 
 export namespace panima {
+	struct AnimationEvent {
+		float time = 0.f;
+		std::string name;
+		std::vector<std::string> arguments;
+	};
+	// Events sorted by time
+	class EventTrack {
+	  public:
+		EventTrack(std::string name = {}) : m_name {std::move(name)} {}
+		const std::string &GetName() const { return m_name; }
+		void SetName(std::string name) { m_name = std::move(name); }
+
+		// Returns the index of the new event
+		uint32_t AddEvent(float time, std::string name, std::vector<std::string> arguments = {});
+		void RemoveEvent(uint32_t idx);
+		void Clear() { m_events.clear(); }
+		const std::vector<AnimationEvent> &GetEvents() const { return m_events; }
+
+		// Returns the index range [first, last) of all events in the time range [tStart, tEnd]. If includeStart
+		// or includeEnd are false, events at exactly tStart or tEnd respectively will be excluded.
+		std::pair<uint32_t, uint32_t> FindEvents(float tStart, float tEnd, bool includeStart = true, bool includeEnd = true) const;
+
+		bool Save(udm::LinkedPropertyWrapper &prop) const;
+		bool Load(udm::LinkedPropertyWrapper &prop);
+		size_t GetMemoryUsage() const;
+	  private:
+		std::string m_name;
+		std::vector<AnimationEvent> m_events;
+	};
+
+	// Root poses sampled at a fixed rate over the duration of an animation
+	struct RootMotion {
+		float sampleRate = 60.f;
+		float duration = 0.f;
+		std::vector<pragma::math::Transform> poses;
+
+		pragma::math::Transform GetPose(float t) const;
+		// Transform from the root pose at tStart to the root pose at tEnd, relative to the pose at tStart
+		pragma::math::Transform GetDelta(float tStart, float tEnd) const;
+	};
+
 	class Animation : public std::enable_shared_from_this<Animation> {
 	  public:
 		enum class Flags : uint32_t { None = 0u, LoopBit = 1u };
+		struct SaveOptions {
+			// Number of threads the channels are serialized on, including the calling thread. 0 = number of hardware threads.
+			uint32_t threadCount = 0;
+			// Channels are serialized in batches of this size, which limits the amount of serialized data that is
+			// held in addition to the output at any time
+			uint32_t batchSize = 64;
+			// Called on the calling thread after each batch
+			std::function<void(uint32_t numChannelsSaved, uint32_t numChannels)> progressCallback = nullptr;
+		};
 		Animation() = default;
 		void AddChannel(Channel &channel);
 		Channel *AddChannel(std::string path, udm::Type valueType);
+		Channel *AddChannel(const ChannelPath &path, udm::Type valueType);
 		void RemoveChannel(std::string path);
 		void RemoveChannel(const Channel &channel);
 		const std::vector<std::shared_ptr<Channel>> &GetChannels() const { return const_cast<Animation *>(this)->GetChannels(); }
 		std::vector<std::shared_ptr<Channel>> &GetChannels() { return m_channels; }
 		uint32_t GetChannelCount() const { return m_channels.size(); }
 		void Merge(const Animation &other);
+		// Bakes the value expressions of all channels into keyframes, returns the number of baked channels
+		uint32_t BakeValueExpressions(const Channel::ExpressionBakeInfo &bakeInfo = {});
 
 		bool Save(udm::LinkedPropertyWrapper &prop) const;
-		bool Load(udm::LinkedPropertyWrapper &prop);
+		// Serializes (and compresses) the channels on multiple threads. If saving a channel throws, the remaining
+		// channels of the batch are skipped and the first exception is rethrown on the calling thread.
+		bool Save(udm::LinkedPropertyWrapper &prop, const SaveOptions &options) const;
+		// See Channel::Load for deferred loading
+		bool Load(udm::LinkedPropertyWrapper &prop, bool deferChannelData = false);
+
+		// Returns the existing track if one with the same name already exists. Returns nullptr if the animation is frozen.
+		EventTrack *AddEventTrack(std::string name);
+		void RemoveEventTrack(const std::string_view &name);
+		// Returns nullptr if the animation is frozen, in which case the tracks can only be accessed through the const overloads
+		EventTrack *FindEventTrack(const std::string_view &name);
+		const EventTrack *FindEventTrack(const std::string_view &name) const;
+		// Tracks are modified through AddEventTrack, FindEventTrack and RemoveEventTrack
+		const std::vector<EventTrack> &GetEventTracks() const { return m_eventTracks; }
+
+		// Samples the root position and rotation channels and stores the resulting root poses, which the player
+		// uses to determine the root motion between two times. Either path may be empty. The root motion is
+		// recomputed automatically if the duration is changed. If the root channels are modified (or channels
+		// are added or removed), it is considered out of date until UpdateRootMotion is called.
+		bool ComputeRootMotion(const ChannelPath &positionPath, const ChannelPath &rotationPath, float sampleRate = 60.f);
+		// Recomputes the root motion with the paths and sample rate of the last ComputeRootMotion call
+		bool UpdateRootMotion();
+		void ClearRootMotion();
+		// Returns nullptr if there is no root motion, or if it is out of date
+		const RootMotion *GetRootMotion() const;
 
 		Channel *FindChannel(std::string path);
-		const Channel *FindChannel(std::string path) const { return const_cast<Animation *>(this)->FindChannel(std::move(path)); }
+		const Channel *FindChannel(std::string path) const { return FindChannel(ChannelPath {path}); }
+		// Faster than the string overload if the path has already been parsed
+		Channel *FindChannel(const ChannelPath &path);
+		const Channel *FindChannel(const ChannelPath &path) const;
+		// Should be called if the target path of a channel was changed directly. Otherwise the first lookup that
+		// misses the index (or finds a channel with a different path) has to search the channels and rebuild it.
+		void UpdateChannelIndex();
+		// Changes whenever channels are added or removed, or any of the channels is modified (see Channel::GetRevision)
+		uint64_t GetRevision() const;
+		// Includes all channels. Channels that are shared with other animations are counted by each of them.
+		MemoryUsage GetMemoryUsage() const;
+		// Returns an immutable snapshot of the animation, which is independent of this animation and consists of
+		// frozen copies of all channels (see Channel::Freeze). All const functions of the snapshot are free of lazy
+		// state, so it can be sampled (and played by any number of players) from multiple threads without locks.
+		// Modifications of the snapshot or its channels are rejected (and assert in debug builds).
+		std::shared_ptr<const Animation> Freeze() const;
+		bool IsFrozen() const { return m_frozen; }
 
 		float GetAnimationSpeedFactor() const { return m_speedFactor; }
 		void SetAnimationSpeedFactor(float f) { m_speedFactor = f; }
@@ -39,17 +132,40 @@ export namespace panima {
 		bool HasFlags(Flags flags) const { return pragma::math::is_flag_set(m_flags, flags); }
 
 		float GetDuration() const { return m_duration; }
-		void SetDuration(float duration) { m_duration = duration; }
+		void SetDuration(float duration);
 
 		bool operator==(const Animation &other) const { return this == &other; }
 		bool operator!=(const Animation &other) const { return !operator==(other); }
 	  private:
-		std::vector<std::shared_ptr<Channel>>::iterator FindChannelIt(std::string path);
+		// Returns false (and asserts) if the animation is frozen, in which case it must not be modified
+		bool CheckMutable() const;
+		std::optional<uint32_t> FindChannelIndex(const ChannelPath &path);
+		void AddChannelToIndex(uint32_t idx);
 		std::vector<std::shared_ptr<Channel>> m_channels;
+		// Channel path id to channel index
+		std::unordered_map<ChannelPathId, uint32_t> m_channelIndex;
+		size_t m_channelIndexSize = 0;
+		uint64_t m_revision = 0;
+		std::vector<EventTrack> m_eventTracks;
+		std::shared_ptr<const RootMotion> m_rootMotion = nullptr;
+		// Channels and revisions the root motion was computed from
+		struct RootMotionSource {
+			ChannelPath positionPath;
+			ChannelPath rotationPath;
+			float sampleRate = 60.f;
+			const Channel *positionChannel = nullptr;
+			const Channel *rotationChannel = nullptr;
+			uint64_t positionRevision = 0;
+			uint64_t rotationRevision = 0;
+			uint64_t animationRevision = 0;
+		};
+		void UpdateRootMotionSource();
+		std::optional<RootMotionSource> m_rootMotionSource {};
 		std::string m_name;
 		float m_speedFactor = 1.f;
 		float m_duration = 0.f;
 		Flags m_flags = Flags::None;
+		bool m_frozen = false;
 	};
 	using namespace pragma::math::scoped_enum::bitwise;
 };
@@ -10,12 +10,15 @@ export module panima:animation_manager;
 import :animation_set;
 import :slice;
 import :player;
+import :pose_cache;
 
 export namespace panima {
+	// The callbacks receive the snapshot of the set that the animation id was resolved against. Unlike the set itself, the
+	// snapshot can't be modified while the callback is running, and it keeps the animation alive.
 	struct AnimationPlayerCallbackInterface {
-		std::function<bool(const AnimationSet &, AnimationId, PlaybackFlags)> onPlayAnimation = nullptr;
+		std::function<bool(const AnimationSet::Snapshot &, AnimationId, PlaybackFlags)> onPlayAnimation = nullptr;
 		std::function<void()> onStopAnimation = nullptr;
-		std::function<void(const AnimationSet &, AnimationId &, PlaybackFlags &)> translateAnimation = nullptr;
+		std::function<void(const AnimationSet::Snapshot &, AnimationId &, PlaybackFlags &)> translateAnimation = nullptr;
 	};
 	class AnimationManager : public std::enable_shared_from_this<AnimationManager> {
 	  public:
@@ -24,16 +27,32 @@ export namespace panima {
 		static constexpr auto INVALID_ANIMATION_SET_INDEX = std::numeric_limits<AnimationSetIndex>::max();
 		static constexpr auto INVALID_ANIMATION_INDEX = INVALID_ANIMATION;
 		static constexpr auto INVALID_ANIMATION_REFERENCE = AnimationReference {INVALID_ANIMATION_SET_INDEX, INVALID_ANIMATION_INDEX};
+		// Pre-resolved animation, can be used to play an animation repeatedly without any name lookups
+		struct AnimationHandle {
+			std::weak_ptr<AnimationSet> animationSet {};
+			AnimationSetIndex animationSetIndex = INVALID_ANIMATION_SET_INDEX;
+			AnimationId animation = INVALID_ANIMATION;
+			// Generation of the animation slot (see AnimationSet::GetGeneration), handles to animations that
+			// were removed in the meantime are rejected, even if their id has been reused
+			uint32_t generation = 0;
+			bool IsValid() const { return animation != INVALID_ANIMATION; }
+		};
 		static std::shared_ptr<AnimationManager> Create(const AnimationManager &other);
 		static std::shared_ptr<AnimationManager> Create(AnimationManager &&other);
 		static std::shared_ptr<AnimationManager> Create();
 
 		AnimationId GetCurrentAnimationId() const { return m_currentAnimation; }
+		// Handle of the current animation, which remains identifiable if its id is reused by the set
+		AnimationHandle GetCurrentAnimationHandle() const;
 		Animation *GetCurrentAnimation() const;
 
 		void PlayAnimation(const std::string &setName, AnimationId animation, PlaybackFlags flags = PlaybackFlags::Default);
 		void PlayAnimation(const std::string &setName, const std::string &animation, PlaybackFlags flags = PlaybackFlags::Default);
 		void PlayAnimation(const std::string &animation, PlaybackFlags flags = PlaybackFlags::Default);
+		void PlayAnimation(const AnimationHandle &handle, PlaybackFlags flags = PlaybackFlags::Default);
+		// Resolves the animation by name, using the same precedence as PlayAnimation (first set wins)
+		AnimationHandle ResolveAnimation(const std::string &animation) const;
+		AnimationHandle ResolveAnimation(const std::string &setName, const std::string &animation) const;
 		void StopAnimation();
 
 		Slice &GetPreviousSlice() { return m_prevAnimSlice; }
@@ -54,6 +73,18 @@ export namespace panima {
 		std::vector<ChannelValueSubmitter> &GetChannelValueSubmitters() { return m_channelValueSubmitters; }
 		const std::vector<ChannelValueSubmitter> &GetChannelValueSubmitters() const { return const_cast<AnimationManager *>(this)->GetChannelValueSubmitters(); }
 
+		// Alternative to the channel value submitters: Samples all channels of the current animation
+		// and passes them to the pose submitter with a single call. Respects the LOD policy of the player,
+		// returns false if the pose was not submitted because it's being held.
+		void SetPoseSubmitter(const PoseSubmitter &submitter) { m_poseSubmitter = submitter; }
+		const PoseSubmitter &GetPoseSubmitter() const { return m_poseSubmitter; }
+		bool SubmitPose();
+		const Pose &GetPose() const { return m_pose; }
+		// Optional cache for sampled poses, which can be shared between managers. If set, poses are sampled
+		// at the quantized time of the cache.
+		void SetPoseCache(const std::shared_ptr<PoseCache> &cache) { m_poseCache = cache; }
+		const std::shared_ptr<PoseCache> &GetPoseCache() const { return m_poseCache; }
+
 		void AddAnimationSet(std::string name, AnimationSet &animSet);
 		const std::vector<PAnimationSet> &GetAnimationSets() const { return m_animationSets; }
 		void RemoveAnimationSet(const std::string_view &name);
@@ -65,11 +96,21 @@ export namespace panima {
 
 		void SetCallbackInterface(const AnimationPlayerCallbackInterface &i) { m_callbackInterface = i; }
 
+		// Memory of the manager, its player and sampling buffers. Animation sets are usually shared between managers and
+		// are only included if requested. A shared pose cache is split evenly between the managers using it.
+		MemoryUsage GetMemoryUsage(bool includeAnimationSets = false) const;
+
 		int32_t GetPriority() const { return m_priority; }
 
 		bool operator==(const AnimationManager &other) const { return this == &other; }
 		bool operator!=(const AnimationManager &other) const { return !operator==(other); }
 	  private:
+		friend class PoseSamplingBatch;
+		// True if the pose would be fully sampled by SubmitPose, i.e. it can be copied from another
+		// manager playing the same animation at the same time
+		bool CanSharePose() const;
+		void SubmitSharedPose(const AnimationManager &source);
+		void CopyPoseValues(const Pose &src, bool fullUpdate);
 		std::optional<AnimationSetIndex> FindAnimationSetIndex(const std::string &name) const;
 		AnimationReference FindAnimation(AnimationSetIndex animSetIndex, AnimationId animation, PlaybackFlags flags) const;
 		AnimationReference FindAnimation(AnimationSetIndex animSetIndex, const std::string &animation, PlaybackFlags flags) const;
@@ -81,23 +122,78 @@ export namespace panima {
 		AnimationManager(AnimationManager &&other);
 		AnimationManager();
 		static void ApplySliceInterpolation(const Slice &src, Slice &dst, float f);
+		void UpdatePoseLayout(const Animation &anim);
 		PPlayer m_player = nullptr;
 
 		int32_t m_priority = 0;
 
+		void UpdateAnimationNameIndex() const;
 		std::vector<PAnimationSet> m_animationSets;
 		pragma::util::StringMap<AnimationSetIndex> m_setNameToIndex;
+		// Animation name to the first animation set containing it, rebuilt lazily when a set has changed
+		mutable struct {
+			pragma::util::StringMap<AnimationReference> nameToAnimation;
+			std::vector<uint32_t> setRevisions;
+			bool dirty = true;
+		} m_animationNameIndex;
 
 		std::weak_ptr<AnimationSet> m_currentAnimationSet {};
 		AnimationId m_currentAnimation = std::numeric_limits<AnimationId>::max();
+		uint32_t m_currentAnimationGeneration = 0;
 
 		PlaybackFlags m_currentFlags = PlaybackFlags::None;
 		std::vector<ChannelValueSubmitter> m_channelValueSubmitters {};
+		PoseSubmitter m_poseSubmitter = nullptr;
+		Pose m_pose;
+		std::shared_ptr<const Animation> m_poseAnimation = nullptr;
+		std::shared_ptr<PoseCache> m_poseCache = nullptr;
+		// Previous and most recent sampled values for LOD interpolation
+		struct PoseLodGroup {
+			std::vector<uint8_t> sourceValues;
+			std::vector<uint8_t> targetValues;
+		};
+		std::vector<PoseLodGroup> m_poseLodGroups;
+		// Pivot keyframes of the values currently in the pose, per channel. These are kept separately from the
+		// pivots of the player, since other consumers (e.g. binding tables) may advance those independently.
+		std::vector<uint32_t> m_poseTimestampIndices;
+		// Channel revisions the values currently in the pose were sampled at. The pivots are meaningless if the
+		// channel has been modified since.
+		std::vector<uint64_t> m_poseChannelRevisions;
 
 		Slice m_prevAnimSlice;
 		mutable AnimationPlayerCallbackInterface m_callbackInterface {};
 	};
 	using PAnimationManager = std::shared_ptr<AnimationManager>;
+
+	// Deduplicates pose sampling for managers that play the same animation at (nearly) the same time, e.g. crowds
+	// playing a few idle loops. All managers are added once per update and then submitted together: The pose of each
+	// distinct animation and time is only sampled once and then copied to the other managers of the group.
+	// The playback rate is not part of the key, since it has no effect on the sampled values.
+	class PoseSamplingBatch {
+	  public:
+		// Players whose times are within the tolerance share the same pose. A tolerance of 0 requires the times to match exactly.
+		PoseSamplingBatch(float timeTolerance = 0.001f) : m_timeTolerance {timeTolerance} {}
+		void SetTimeTolerance(float tolerance) { m_timeTolerance = tolerance; }
+		float GetTimeTolerance() const { return m_timeTolerance; }
+
+		void Add(AnimationManager &manager);
+		void Clear() { m_entries.clear(); }
+		size_t GetSize() const { return m_entries.size(); }
+
+		// Submits the poses of all managers in the batch (see AnimationManager::SubmitPose) and clears the batch.
+		// Managers that hold or interpolate their pose because of their LOD policy are submitted individually.
+		// Returns the number of poses that had to be sampled.
+		uint32_t Submit();
+	  private:
+		struct Entry {
+			AnimationManager *manager = nullptr;
+			const Animation *animation = nullptr;
+			int64_t timeKey = 0;
+		};
+		std::vector<Entry> m_entries;
+		float m_timeTolerance = 0.001f;
+	};
+
 	using namespace pragma::math::scoped_enum::bitwise;
 };
 
@@ -3,14 +3,23 @@
 
 module;
 
+#include <version>
+
 export module panima:animation_set;
 
 import :animation;
 import :types;
 
 export namespace panima {
+	// Modifications of a set are published as immutable snapshots (see GetSnapshot). The set can be modified on one
+	// thread (e.g. when reloading animations), while any number of other threads read from the latest snapshot
+	// without taking the write lock. Replaced animations are kept alive by the snapshots and players still referencing them.
+	// All other accessors read the current state of the set directly and may only be used on the modifying thread.
+	// Every published snapshot copies the animation list and the name map, so batches of modifications should be
+	// wrapped in BeginUpdate/EndUpdate to publish them once.
 	class AnimationSet : public std::enable_shared_from_this<AnimationSet> {
 	  public:
+		class Snapshot;
 		static std::shared_ptr<AnimationSet> Create();
 		void Clear();
 		void AddAnimation(Animation &anim);
@@ -21,6 +30,9 @@ export namespace panima {
 		Animation *GetAnimation(AnimationId id);
 		const Animation *GetAnimation(AnimationId id) const { return const_cast<AnimationSet *>(this)->GetAnimation(id); }
 
+		// Indexed by animation id. Removed animations leave a nullptr slot behind (which may be reused by a later
+		// AddAnimation), so that the ids of the other animations remain valid. Callers iterating the list have to
+		// skip these slots. Publish has to be called if the animations are modified directly.
 		std::vector<std::shared_ptr<Animation>> &GetAnimations() { return m_animations; }
 		const std::vector<std::shared_ptr<Animation>> &GetAnimations() const { return const_cast<AnimationSet *>(this)->GetAnimations(); }
 
@@ -28,14 +40,93 @@ export namespace panima {
 		const Animation *FindAnimation(const std::string_view &animName) const { return const_cast<AnimationSet *>(this)->FindAnimation(animName); }
 
 		void Reserve(uint32_t count);
+		// Number of animations in the set
 		uint32_t GetSize() const;
+		// Number of animation slots, including free slots of removed animations (which are nullptr). All valid
+		// animation ids are smaller than this.
+		uint32_t GetSlotCount() const { return m_animations.size(); }
+		// Incremented whenever the animation in the slot is removed. An id together with its generation uniquely
+		// identifies an animation, even if the id has been reused by another animation since.
+		uint32_t GetGeneration(AnimationId id) const;
+
+		// Builds a minimal perfect hash for name lookups. Intended for sets that aren't changed anymore,
+		// adding or removing animations will unfreeze the set. Returns false if no perfect hash could be found.
+		bool Freeze();
+		void Unfreeze();
+		bool IsFrozen() const { return m_frozenIndex != nullptr; }
+		// Incremented whenever animations are added, replaced or removed. Returns the revision of the latest snapshot.
+		uint32_t GetRevision() const;
+		// Returns the most recently published state of the set. Thread-safe, but depending on the standard library the
+		// atomic shared_ptr may use an internal lock (it does in libstdc++). The snapshot remains valid for as long as
+		// it is referenced, regardless of later modifications of the set.
+		std::shared_ptr<const Snapshot> GetSnapshot() const;
+		// Publishes the current state of the set. Called automatically by all functions that modify the set, unless
+		// an update is in progress.
+		void Publish();
+		// Defers publishing until the matching EndUpdate call, which publishes all modifications since BeginUpdate as
+		// a single snapshot. Other writers are blocked in the meantime. Calls can be nested.
+		void BeginUpdate();
+		void EndUpdate();
+		// Includes all animations. Animations that are shared with other sets are counted by each of them.
+		MemoryUsage GetMemoryUsage() const;
 
 		bool operator==(const AnimationSet &other) const { return this == &other; }
 		bool operator!=(const AnimationSet &other) const { return !operator==(other); }
 	  private:
+		struct NameHash {
+			using is_transparent = void;
+			size_t operator()(const std::string_view &name) const { return std::hash<std::string_view> {}(name); }
+		};
+		// Hash-and-displace minimal perfect hash of all animation names
+		struct FrozenIndex {
+			std::vector<uint32_t> displacements;
+			std::vector<std::string> names;
+			std::vector<AnimationId> ids;
+		};
+		using NameMap = std::unordered_map<std::string, AnimationId, NameHash, std::equal_to<>>;
 		AnimationSet();
+		static std::optional<AnimationId> LookupAnimation(const NameMap &nameToId, const FrozenIndex *frozenIndex, const std::string_view &animName);
+		static std::optional<AnimationId> LookupFrozenAnimation(const FrozenIndex &index, const std::string_view &animName);
+		std::vector<std::shared_ptr<Animation>> m_animations;
+		// Generation of each slot, never shrinks
+		std::vector<uint32_t> m_generations;
+		std::vector<AnimationId> m_freeIds;
+		NameMap m_nameToId;
+		// Shared with the snapshots
+		std::shared_ptr<const FrozenIndex> m_frozenIndex = nullptr;
+		uint32_t m_revision = 0;
+		// Publishes the snapshot, unless an update is in progress
+		void PublishChanges();
+		// Serializes modifications, readers of the snapshot never lock it
+		std::recursive_mutex m_writeMutex;
+		uint32_t m_updateDepth = 0;
+#ifdef __cpp_lib_atomic_shared_ptr
+		std::atomic<std::shared_ptr<const Snapshot>> m_snapshot;
+#else
+		// libc++ doesn't implement std::atomic<std::shared_ptr>, the (deprecated) atomic free functions are used instead
+		std::shared_ptr<const Snapshot> m_snapshot;
+#endif
+	};
+
+	class AnimationSet::Snapshot {
+	  public:
+		std::optional<AnimationId> LookupAnimation(const std::string_view &animName) const;
+		const Animation *GetAnimation(AnimationId id) const;
+		const Animation *FindAnimation(const std::string_view &animName) const;
+		// Free slots of removed animations are nullptr
+		const std::vector<std::shared_ptr<Animation>> &GetAnimations() const { return m_animations; }
+		uint32_t GetSize() const { return m_animationCount; }
+		uint32_t GetSlotCount() const { return m_animations.size(); }
+		uint32_t GetGeneration(AnimationId id) const;
+		uint32_t GetRevision() const { return m_revision; }
+	  private:
+		friend AnimationSet;
 		std::vector<std::shared_ptr<Animation>> m_animations;
-		std::unordered_map<size_t, size_t> m_nameToId;
+		std::vector<uint32_t> m_generations;
+		NameMap m_nameToId;
+		std::shared_ptr<const FrozenIndex> m_frozenIndex = nullptr;
+		uint32_t m_animationCount = 0;
+		uint32_t m_revision = 0;
 	};
 	using PAnimationSet = std::shared_ptr<AnimationSet>;
 };
@@ -0,0 +1,61 @@
+// SPDX-FileCopyrightText: (c) 2025 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+export module panima:binding;
+
+import :animation;
+import :channel;
+import :player;
+
+export namespace panima {
+	// Maps the channels of an animation to typed destinations in caller-owned memory (e.g. component data).
+	// Each channel is resolved once, after which all bound values can be sampled and written with a
+	// single call to Apply. Bindings are grouped by source and destination type, so each group is
+	// processed by one specialized copy/convert kernel.
+	// The table has to be rebuilt if channels are added to or removed from the animation.
+	class ChannelBindingTable {
+	  public:
+		struct Binding {
+			const Channel *channel = nullptr;
+			AnimationChannelId channelIndex = 0;
+			// Byte offset of the destination relative to the base pointer passed to Apply
+			size_t offset = 0;
+			// Pivot keyframe of the value most recently written by this table
+			uint32_t timestampIndex = std::numeric_limits<uint32_t>::max();
+			// Channel revision the value most recently written by this table was sampled at
+			uint64_t revision = 0;
+		};
+		using Kernel = void (*)(Binding *bindings, size_t count, float t, bool skipLowPriority, bool skipUnchanged, uint8_t *base);
+
+		ChannelBindingTable() = default;
+		void SetAnimation(const Animation &anim);
+		const Animation *GetAnimation() const { return m_animation.get(); }
+
+		// The destination type has to either match the channel value type, or has to be convertible from it
+		bool Bind(const ChannelPath &path, udm::Type dstType, size_t offset);
+		bool Bind(AnimationChannelId channelIndex, udm::Type dstType, size_t offset);
+		void Clear();
+		uint32_t GetBindingCount() const;
+
+		// Samples all bound channels at the current time of the player and writes the values to their destinations.
+		// The player has to be playing the animation of this table. Returns false if nothing was written, either
+		// because of the player's LOD policy (in which case the destinations keep their values) or an invalid player.
+		// Destinations of channels whose value is known not to have changed since the previous call are not written
+		// to, unless the player requests a full update. Since this depends on the previous call, a table should only be
+		// used with one player and destination; switching to a different one results in a full update.
+		bool Apply(Player &player, void *base);
+	  private:
+		struct KernelGroup {
+			udm::Type srcType = udm::Type::Invalid;
+			udm::Type dstType = udm::Type::Invalid;
+			Kernel kernel = nullptr;
+			std::vector<Binding> bindings;
+		};
+		std::shared_ptr<const Animation> m_animation = nullptr;
+		std::vector<KernelGroup> m_groups;
+		const Player *m_lastPlayer = nullptr;
+		const void *m_lastBase = nullptr;
+	};
+};
@@ -19,23 +19,38 @@ export namespace panima {
 	constexpr std::string_view ANIMATION_CHANNEL_PATH_SCALE = "scale";
 
 	// Example URI: panima:ec/color/color?components=red,blue
+	// Every distinct path (including its components) is interned in a global table and assigned
+	// a unique id, which is used for comparisons. The id of the empty path is always 0.
+	using ChannelPathId = uint32_t;
 	struct ChannelPath {
 		ChannelPath() = default;
 		ChannelPath(const std::string &path);
 		ChannelPath(const ChannelPath &other);
 
-		bool operator==(const ChannelPath &other) const;
-		bool operator!=(const ChannelPath &other) const { return !const_cast<ChannelPath *>(this)->operator==(other); }
+		bool operator==(const ChannelPath &other) const { return m_id == other.m_id; }
+		bool operator!=(const ChannelPath &other) const { return !operator==(other); }
 		ChannelPath &operator=(const ChannelPath &other);
 
-		std::vector<std::string> *GetComponents() { return m_components.get(); }
-		const std::vector<std::string> *GetComponents() const { return const_cast<ChannelPath *>(this)->GetComponents(); }
-		pragma::util::Path path;
+		// The path and components can only be changed through the setters, which re-intern the path,
+		// so that the id always matches the contents
+		const pragma::util::Path &GetPath() const { return m_path; }
+		void SetPath(pragma::util::Path path);
+		const std::vector<std::string> *GetComponents() const { return m_components.get(); }
+		void SetComponents(std::vector<std::string> components);
+		void ClearComponents();
 
 		operator std::string() const { return ToUri(); }
 		std::string ToUri(bool includeScheme = true) const;
+		ChannelPathId GetId() const { return m_id; }
+		// Memory used by all interned paths
+		static size_t GetRegistryMemoryUsage();
+		size_t GetHash() const;
 	  private:
+		void Parse(const std::string &path);
+		void Intern();
+		pragma::util::Path m_path;
 		std::unique_ptr<std::vector<std::string>> m_components = nullptr;
+		ChannelPathId m_id = 0;
 	};
 
 	namespace expression {
@@ -78,6 +93,22 @@ export namespace panima {
 			DecimateInsertedData = ClearExistingDataInRange << 1u,
 		};
 
+		enum class Flags : uint8_t {
+			None = 0u,
+			// Low-priority channels may be skipped during sampling, depending on the player's LOD policy
+			LowPriority = 1u,
+		};
+
+		struct ExpressionBakeInfo {
+			// Number of samples per second
+			float sampleRate = 60.f;
+			// If set, the baked data will be decimated with the specified error tolerance
+			std::optional<float> decimationError {};
+			// Additional time range (in animation time) to bake. The time range
+			// of the channel's keyframes is always included.
+			std::optional<std::pair<float, float>> timeRange {};
+		};
+
 		static constexpr auto VALUE_EPSILON = 0.001f;
 		static constexpr float TIME_EPSILON = 0.0001f;
 		static constexpr bool ENABLE_VALIDATION = true;
@@ -93,16 +124,21 @@ export namespace panima {
 		ChannelInterpolation interpolation = ChannelInterpolation::Linear;
 		ChannelPath targetPath;
 
+		Flags GetFlags() const { return m_flags; }
+		void SetFlags(Flags flags) { m_flags = flags; }
+		bool HasFlags(Flags flags) const { return pragma::math::is_flag_set(m_flags, flags); }
+
 		template<typename T>
 		uint32_t AddValue(float t, const T &value);
 		template<typename T>
 		uint32_t InsertValues(uint32_t n, const float *times, const T *values, float offset = 0.f, InsertFlags flags = InsertFlags::ClearExistingDataInRange);
 		void RemoveValueAtIndex(uint32_t idx);
 
-		udm::Array &GetTimesArray();
-		const udm::Array &GetTimesArray() const { return const_cast<Channel *>(this)->GetTimesArray(); }
-		udm::Array &GetValueArray();
-		const udm::Array &GetValueArray() const { return const_cast<Channel *>(this)->GetValueArray(); }
+		// The const accessors don't modify the channel (other than resolving a deferred load), so that frozen channels can be read concurrently
+		udm::Array &GetTimesArray() { return const_cast<udm::Array &>(const_cast<const Channel *>(this)->GetTimesArray()); }
+		const udm::Array &GetTimesArray() const;
+		udm::Array &GetValueArray() { return const_cast<udm::Array &>(const_cast<const Channel *>(this)->GetValueArray()); }
+		const udm::Array &GetValueArray() const;
 		udm::Type GetValueType() const;
 		void SetValueType(udm::Type type);
 		bool Validate() const;
@@ -118,7 +154,16 @@ export namespace panima {
 		void MergeValues(const Channel &other);
 
 		bool Save(udm::LinkedPropertyWrapper &prop) const;
-		bool Load(udm::LinkedPropertyWrapper &prop);
+		// If deferred is true, the keyframe arrays are kept compressed and the value expression is not compiled until
+		// the channel data is first accessed (e.g. when it is sampled). This is transparent to the rest of the API.
+		bool Load(udm::LinkedPropertyWrapper &prop, bool deferred = false);
+		bool IsLoadDeferred() const { return m_deferredLoad && m_deferredLoad->pending.load(std::memory_order_acquire); }
+		// Completes a deferred load, can be called to avoid the cost on first access. Thread-safe.
+		void ResolveDeferredLoad() const
+		{
+			if(IsLoadDeferred()) [[unlikely]]
+				DoResolveDeferredLoad();
+		}
 
 		udm::Property &GetTimesProperty() { return *m_times; }
 		const udm::Property &GetTimesProperty() const { return const_cast<Channel *>(this)->GetTimesProperty(); }
@@ -139,13 +184,13 @@ export namespace panima {
 			return const_cast<Channel *>(this)->It<T>();
 		}
 		template<typename T>
-		T &GetValue(uint32_t idx);
-		template<typename T>
-		const T &GetValue(uint32_t idx) const
+		T &GetValue(uint32_t idx)
 		{
-			return const_cast<Channel *>(this)->GetValue<T>(idx);
+			return const_cast<T &>(const_cast<const Channel *>(this)->GetValue<T>(idx));
 		}
 		template<typename T>
+		const T &GetValue(uint32_t idx) const;
+		template<typename T>
 		auto GetInterpolationFunction() const;
 		template<typename T, bool VALIDATE = ENABLE_VALIDATION>
 		T GetInterpolatedValue(float t, uint32_t &inOutPivotTimeIndex, T (*interpFunc)(const T &, const T &, float) = nullptr) const;
@@ -182,8 +227,19 @@ export namespace panima {
 		bool SetValueExpression(std::string expression, std::string &outErr);
 		bool TestValueExpression(std::string expression, std::string &outErr);
 		const std::string *GetValueExpression() const;
-
-		void SetTimeFrame(TimeFrame timeFrame) { m_timeFrame = std::move(timeFrame); }
+		// Returns true if the channel has a value expression which always evaluates to the same result
+		bool IsValueExpressionConstant() const;
+		// Returns true if the channel has a value expression which doesn't depend on the channel values
+		bool IsValueExpressionValueIndependent() const;
+		// Returns true if the channel has a value expression with side effects or state (e.g. noise), in which
+		// case the result can differ between evaluations with the same inputs
+		bool IsValueExpressionImpure() const;
+		// Evaluates the value expression over the time range of the channel, replaces the
+		// channel data with the results and removes the expression.
+		bool BakeValueExpression(const ExpressionBakeInfo &bakeInfo = {});
+
+		void SetTimeFrame(TimeFrame timeFrame);
+		// Update has to be called after the time frame has been modified through the returned reference
 		TimeFrame &GetTimeFrame() { return m_timeFrame; }
 		const TimeFrame &GetTimeFrame() const { return const_cast<Channel *>(this)->GetTimeFrame(); }
 
@@ -191,6 +247,26 @@ export namespace panima {
 		uint32_t GetSize() const;
 		void Update();
 
+		// True if all keyframe values are equal. Like the flat segments, this is only computed by Load, Update and
+		// Optimize and is reset by any other edit, in which case it conservatively returns false.
+		bool IsConstant() const { return m_constant; }
+		// Returns true if sampling the channel at time t is guaranteed to yield the same value as the previous
+		// sample, where pivotTimeIndex is the time index that was returned by the previous sample. The result is only
+		// meaningful if the revision of the channel hasn't changed since the previous sample (see GetRevision).
+		bool IsSampleUnchanged(float t, uint32_t pivotTimeIndex) const;
+		void UpdateSampleInfo();
+		// Changes whenever the channel data is modified through the channel, or when Update is called.
+		// Revisions are unique across all channels and animations and only ever increase.
+		uint64_t GetRevision() const { return m_revision; }
+		// Does not include the channel path, since paths are interned (see ChannelPath::GetRegistryMemoryUsage)
+		MemoryUsage GetMemoryUsage() const;
+		// Returns an immutable copy of the channel with uncompressed keyframe arrays, a compiled value expression
+		// and up-to-date sample info. Unlike regular channels, which may decompress or resolve data lazily on first
+		// access, frozen channels have no lazy state and can be sampled by any number of threads at once.
+		// Modifications of a frozen channel are rejected (and assert in debug builds).
+		std::shared_ptr<const Channel> Freeze() const;
+		bool IsFrozen() const { return m_frozen; }
+
 		size_t Optimize();
 
 		bool operator==(const Channel &other) const { return this == &other; }
@@ -222,9 +298,31 @@ export namespace panima {
 		std::unique_ptr<expression::ValueExpression> m_valueExpression; //default constructor is sufficient
 		TimeFrame m_timeFrame {};
 		TimeFrame m_effectiveTimeFrame {};
+		Flags m_flags = Flags::None;
+
+		// A segment is flat if the keyframe values at both of its ends are equal
+		std::vector<bool> m_flatSegments;
+		bool m_constant = false;
+		bool m_frozen = false;
+		uint64_t m_revision = 0;
 
 		// Cached variables for faster lookup
 		void UpdateLookupCache();
+		void InvalidateSampleInfo();
+		// Copies everything except for the keyframe data and sample info
+		void CopyState(const Channel &other);
+		// Returns false (and asserts) if the channel is frozen, in which case it must not be modified
+		bool CheckMutable() const;
+
+		struct DeferredLoadState {
+			std::recursive_mutex mutex;
+			std::atomic<bool> pending = true;
+			// Set while the load is being resolved, accesses from within the resolve have to go through
+			bool resolving = false;
+			std::optional<std::string> expression {};
+		};
+		void DoResolveDeferredLoad() const;
+		std::unique_ptr<DeferredLoadState> m_deferredLoad = nullptr;
 		udm::Array *m_timesArray = nullptr;
 		udm::Array *m_valueArray = nullptr;
 		float *m_timesData = nullptr;
@@ -273,6 +371,7 @@ export namespace panima {
 
 export {
 	REGISTER_ENUM_FLAGS(panima::Channel::InsertFlags)
+	REGISTER_ENUM_FLAGS(panima::Channel::Flags)
 
 	std::ostream &operator<<(std::ostream &out, const panima::Channel &o);
 	std::ostream &operator<<(std::ostream &out, const panima::TimeFrame &o);
@@ -280,6 +379,9 @@ export {
 };
 
 namespace panima {
+	// Process-wide, strictly increasing revision counter
+	uint64_t get_next_revision();
+
 	constexpr auto ANIMATION_CHANNEL_TYPE_POSITION = udm::Type::Vector3;
 	constexpr auto ANIMATION_CHANNEL_TYPE_ROTATION = udm::Type::Quaternion;
 	constexpr auto ANIMATION_CHANNEL_TYPE_SCALE = udm::Type::Vector3;
@@ -403,9 +505,10 @@ panima::Channel::IteratorWrapper<T> panima::Channel::It()
 /////////////////////
 
 template<typename T>
-T &panima::Channel::GetValue(uint32_t idx)
+const T &panima::Channel::GetValue(uint32_t idx) const
 {
-	return *(static_cast<T *>(m_valueData) + idx);
+	ResolveDeferredLoad();
+	return *(static_cast<const T *>(m_valueData) + idx);
 }
 
 template<typename T>
@@ -4,10 +4,12 @@
 module;
 
 #include <exprtk.hpp>
+#include "util_enum_flags.hpp"
 
 export module panima:expression;
 
 import :channel;
+import :instrumentation;
 export import pragma.udm;
 
 export namespace panima {
@@ -28,6 +30,29 @@ export namespace panima {
 		    std::conditional_t<std::is_same_v<T, udm::Vector4> || std::is_same_v<T, udm::Vector4i> || std::is_same_v<T, udm::Quaternion> || std::is_same_v<T, udm::Srgba>, Vector4,
 		      std::conditional_t<std::is_same_v<T, udm::Mat3x4>, Mat3x4, std::conditional_t<std::is_same_v<T, udm::Mat4>, Mat4, Single>>>>>;
 
+		// Result of the dependency analysis of a compiled expression
+		enum class ExpressionFlags : uint32_t {
+			None = 0u,
+			UsesTime = 1u,
+			UsesTimeIndex = UsesTime << 1u,
+			UsesTimeFrame = UsesTimeIndex << 1u, // startOffset, timeScale or duration
+			UsesValue = UsesTimeFrame << 1u,
+			UsesValueAt = UsesValue << 1u,
+			Impure = UsesValueAt << 1u, // Uses functions with side effects or state, e.g. noise or print
+
+			// Expression always evaluates to the same result and has been folded
+			Constant = Impure << 1u,
+		};
+
+		// Type-independent result of an expression evaluation
+		struct EvaluationResult {
+			ExprScalar scalar {0};
+			// Only valid if the expression returned a vector
+			std::array<ExprScalar, 16> values {};
+			uint32_t size = 0;
+			bool isVector = false;
+		};
+
 		constexpr bool is_supported_expression_type(udm::Type type)
 		{
 			return udm::visit(type, [](auto tag) { return is_supported_expression_type_v<typename decltype(tag)::type>; });
@@ -76,19 +101,20 @@ export namespace panima {
 		struct ExprFuncPerlinNoise : public exprtk::ifunction<ExprScalar> {
 			using ifunction<ExprScalar>::operator();
 
-			ExprFuncPerlinNoise() : ifunction<ExprScalar>(3) {}
+			ExprFuncPerlinNoise(uint32_t seed) : ifunction<ExprScalar>(3), m_noise {seed} {}
 
 			ExprScalar operator()(const ExprScalar &v1, const ExprScalar &v2, const ExprScalar &v3) override;
 		  private:
-			pragma::math::PerlinNoise m_noise {static_cast<uint32_t>(pragma::math::random(std::numeric_limits<int>::lowest(), std::numeric_limits<int>::max()))};
+			pragma::math::PerlinNoise m_noise;
 		};
+		struct EvaluationContext;
 		struct BaseExprFuncValueAt {
 			BaseExprFuncValueAt() = default;
 			~BaseExprFuncValueAt() {}
 
-			void SetValueExpression(ValueExpression &expr) { m_valueExpression = &expr; }
+			void SetContext(EvaluationContext &context) { m_context = &context; }
 		  protected:
-			ValueExpression *m_valueExpression = nullptr;
+			EvaluationContext *m_context = nullptr;
 		};
 		template<typename T>
 		struct ExprFuncValueAtArithmetic : public BaseExprFuncValueAt, public exprtk::ifunction<ExprScalar> {
@@ -108,6 +134,17 @@ export namespace panima {
 
 			ExprScalar operator()(parameter_list_t parameters) override;
 		};
+		// value_range(tStart, tEnd, out): Writes evenly spaced samples in the range [tStart, tEnd] to the output vector.
+		// For non-scalar channels, the components of each sample are written consecutively. Returns the number of samples.
+		template<typename T>
+		struct ExprFuncValueRange : public BaseExprFuncValueAt, public exprtk::igeneric_function<ExprScalar> {
+			using igeneric_function<ExprScalar>::operator();
+
+			ExprFuncValueRange() : igeneric_function<ExprScalar> {"TTV"} {}
+			~ExprFuncValueRange() {}
+
+			ExprScalar operator()(parameter_list_t parameters) override;
+		};
 
 		template<typename T, T (*TEval)(typename exprtk::igeneric_function<T>::parameter_list_t)>
 		struct ExprFuncGeneric : public exprtk::igeneric_function<T> {
@@ -170,29 +207,135 @@ export namespace panima {
 			}
 		};
 
-		struct ValueExpression {
-			ValueExpression(Channel &channel) : channel {channel} {}
-			ValueExpression(const ValueExpression &other);
-			~ValueExpression();
-			Channel &channel;
-			std::string expression;
+		// Built-in symbol tables and parser, shared by all contexts created on the same thread (see value_expression.cpp)
+		struct SymbolTableSet;
+		// Evaluation state of a value expression. exprtk binds variables by address, so every context
+		// owns its own variables and compiled expression tree. A context is only ever used by one
+		// thread at a time.
+		struct EvaluationContext {
+			EvaluationContext(uint32_t noiseSeed) : f_perlinNoise {noiseSeed} {}
+			~EvaluationContext();
+			// Channel that is currently being evaluated
+			const Channel *channel = nullptr;
+			std::shared_ptr<SymbolTableSet> symbolTableSet = nullptr;
+			exprtk::symbol_table<ExprScalar> symbolTable;
+			exprtk::expression<ExprScalar> expression;
+			ExprFuncPerlinNoise f_perlinNoise;
+			std::shared_ptr<BaseExprFuncValueAt> f_valueAt = nullptr;
+			std::shared_ptr<BaseExprFuncValueAt> f_valueRange = nullptr;
+
+			std::variant<Single, Vector2, Vector3, Vector4, Mat3x4, Mat4> value;
+			ExprScalar time {0.0};
+			ExprScalar timeIndex {0};
+
+			ExprScalar startOffset {0.0};
+			ExprScalar timeScale {1.0};
+			ExprScalar duration {0.0};
+
+			// Samples looked up by value_at during the current evaluation. Filters tend to sample the same
+			// or neighboring times repeatedly, so we keep a few recent results and a search cursor.
+			struct ValueAtCache {
+				static constexpr uint32_t SIZE = 4;
+				void Reset(uint32_t pivotTimeIndex)
+				{
+					count = 0;
+					next = 0;
+					pivot = pivotTimeIndex;
+				}
+				std::array<ExprScalar, SIZE> times {};
+				std::array<std::array<ExprScalar, 16>, SIZE> values {};
+				uint32_t count = 0;
+				uint32_t next = 0;
+				uint32_t pivot = 0;
+			} valueAtCache;
+
+			// Last result, only used for expressions that don't depend on the channel value
 			struct {
-				exprtk::symbol_table<ExprScalar> symbolTable;
-				exprtk::expression<ExprScalar> expression;
-				exprtk::parser<ExprScalar> parser;
-				ExprFuncPerlinNoise f_perlinNoise {};
-				std::shared_ptr<BaseExprFuncValueAt> f_valueAt = nullptr;
-
-				std::variant<Single, Vector2, Vector3, Vector4, Mat3x4, Mat4> value;
+				std::optional<EvaluationResult> result {};
 				ExprScalar time {0.0};
 				ExprScalar timeIndex {0};
-
 				ExprScalar startOffset {0.0};
 				ExprScalar timeScale {1.0};
 				ExprScalar duration {0.0};
-			} expr;
+			} cache;
+		};
+
+		// Compiled form of an expression. Instances are shared between all channels using the same
+		// expression and value type (see get_compiled_expression). Evaluation contexts are pooled,
+		// which allows several threads to evaluate the same expression at once.
+		class CompiledExpression {
+		  public:
+			// Immutable data describing the expression
+			struct Program {
+				std::string expression;
+				udm::Type type = udm::Type::Invalid;
+				uint32_t noiseSeed = 0;
+				ExpressionFlags flags = ExpressionFlags::None;
+				std::optional<EvaluationResult> constantResult {};
+			};
+			// Acquires an evaluation context for the duration of its lifetime
+			class ScopedContext {
+			  public:
+				ScopedContext(CompiledExpression &compiledExpression) : m_compiledExpression {compiledExpression}, m_context {compiledExpression.AcquireContext()} {}
+				ScopedContext(const ScopedContext &) = delete;
+				ScopedContext &operator=(const ScopedContext &) = delete;
+				~ScopedContext()
+				{
+					if(m_context)
+						m_compiledExpression.ReleaseContext(*m_context);
+				}
+				EvaluationContext *operator->() { return m_context; }
+				EvaluationContext &operator*() { return *m_context; }
+				explicit operator bool() const { return m_context != nullptr; }
+			  private:
+				CompiledExpression &m_compiledExpression;
+				EvaluationContext *m_context = nullptr;
+			};
+
+			static std::shared_ptr<CompiledExpression> Compile(std::string expression, udm::Type type, std::string &outErr);
+			CompiledExpression(const CompiledExpression &) = delete;
+			CompiledExpression &operator=(const CompiledExpression &) = delete;
+			~CompiledExpression();
+
+			const Program &GetProgram() const { return m_program; }
+			// Estimate, the internal state of exprtk is only accounted for by the size of its top-level objects
+			size_t GetMemoryUsage() const;
+			void Evaluate(EvaluationContext &context, EvaluationResult &outResult) const;
+		  private:
+			CompiledExpression() = default;
+			std::unique_ptr<EvaluationContext> CreateContext(std::string &outErr, std::vector<std::string> *optOutSymbols = nullptr) const;
+			EvaluationContext *AcquireContext();
+			void ReleaseContext(EvaluationContext &context);
+
+			Program m_program;
+			// The primary context can be acquired without a lock, additional contexts
+			// are only created if the expression is evaluated by multiple threads at once.
+			EvaluationContext *m_primaryContext = nullptr;
+			std::atomic<bool> m_primaryContextInUse = false;
+			std::vector<std::unique_ptr<EvaluationContext>> m_contexts;
+			std::vector<EvaluationContext *> m_freeContexts;
+			mutable std::mutex m_contextMutex;
+		};
+		// Returns the compiled expression from the process-wide cache, or compiles it if it isn't cached yet.
+		// Impure expressions (e.g. using noise) are never shared.
+		std::shared_ptr<CompiledExpression> get_compiled_expression(const std::string &expression, udm::Type type, std::string &outErr);
+
+		struct ValueExpression {
+			ValueExpression(Channel &channel) : channel {channel} {}
+			ValueExpression(Channel &channel, const ValueExpression &other);
+			ValueExpression(const ValueExpression &other);
+			Channel &channel;
+			std::string expression;
 
 			bool Initialize(udm::Type type, std::string &outErr);
+			const std::shared_ptr<CompiledExpression> &GetCompiledExpression() const { return m_compiledExpression; }
+			size_t GetMemoryUsage() const;
+			ExpressionFlags GetFlags() const;
+			// Returns true if the expression always evaluates to the same result
+			bool IsConstant() const;
+			// Returns true if the result only depends on the time (and time frame), in which
+			// case it is cached for repeated evaluations at the same time.
+			bool IsValueIndependent() const;
 			template<typename T>
 			    requires(is_supported_expression_type_v<T>)
 			void Apply(double time, uint32_t timeIndex, const TimeFrame &timeFrame, T &inOutValue)
@@ -202,14 +345,59 @@ export namespace panima {
 		  private:
 			template<typename T>
 			void DoApply(double time, uint32_t timeIndex, const TimeFrame &timeFrame, T &inOutValue);
-			udm::Type m_type = udm::Type::Invalid;
+			template<typename T>
+			static void ApplyResult(const EvaluationResult &result, T &inOutValue);
+
+			std::shared_ptr<CompiledExpression> m_compiledExpression = nullptr;
 		};
+		using namespace pragma::math::scoped_enum::bitwise;
 	};
 };
 
+export {
+	REGISTER_ENUM_FLAGS(panima::expression::ExpressionFlags)
+};
+
+template<typename T>
+void panima::expression::ValueExpression::ApplyResult(const EvaluationResult &result, T &inOutValue)
+{
+	constexpr auto n = udm::get_numeric_component_count(udm::type_to_enum<T>());
+	if constexpr(n == 1)
+		inOutValue = static_cast<T>(result.scalar);
+	else {
+		using TBase = udm::underlying_numeric_type<T>;
+		if(result.isVector) {
+			if(result.size == n) {
+				auto *ptr = reinterpret_cast<TBase *>(&inOutValue);
+				for(auto i = decltype(n) {0u}; i < n; ++i)
+					ptr[i] = static_cast<TBase>(result.values[i]);
+			}
+		}
+		else if constexpr(udm::is_vector_type<T>) {
+			// Expression returned a single float value?
+			// We'll assume it's intended to be interpreted as a vector
+			inOutValue = T {static_cast<typename T::value_type>(result.scalar)};
+		}
+	}
+}
+
 template<typename T>
 void panima::expression::ValueExpression::DoApply(double time, uint32_t timeIndex, const TimeFrame &timeFrame, T &inOutValue)
 {
+	if(!m_compiledExpression)
+		return;
+	auto &compiledExpression = *m_compiledExpression;
+	auto &program = compiledExpression.GetProgram();
+	if(program.constantResult) {
+		ApplyResult(*program.constantResult, inOutValue);
+		return;
+	}
+	instrumentation::ScopedTimer timer {instrumentation::Timer::ExpressionApply};
+	CompiledExpression::ScopedContext context {compiledExpression};
+	if(!context)
+		return;
+	auto &expr = *context;
+	expr.channel = &channel;
 	expr.time = time;
 	expr.timeIndex = static_cast<double>(timeIndex);
 
@@ -217,65 +405,44 @@ void panima::expression::ValueExpression::DoApply(double time, uint32_t timeInde
 	expr.timeScale = timeFrame.scale;
 	expr.duration = timeFrame.duration;
 
+	if((program.flags & (ExpressionFlags::UsesValue | ExpressionFlags::UsesValueAt | ExpressionFlags::Impure)) == ExpressionFlags::None) {
+		// The result only depends on the time, so we can re-use the last result if the time hasn't changed
+		auto &cache = expr.cache;
+		if(cache.result && cache.time == expr.time && cache.timeIndex == expr.timeIndex && cache.startOffset == expr.startOffset && cache.timeScale == expr.timeScale && cache.duration == expr.duration) {
+			ApplyResult(*cache.result, inOutValue);
+			return;
+		}
+		cache.result = EvaluationResult {};
+		compiledExpression.Evaluate(expr, *cache.result);
+		cache.time = expr.time;
+		cache.timeIndex = expr.timeIndex;
+		cache.startOffset = expr.startOffset;
+		cache.timeScale = expr.timeScale;
+		cache.duration = expr.duration;
+		ApplyResult(*cache.result, inOutValue);
+		return;
+	}
+
 	constexpr auto n = udm::get_numeric_component_count(udm::type_to_enum<T>());
-	using type_t = exprtk::results_context<ExprScalar>::type_store_t;
 	if constexpr(std::is_same_v<udm::underlying_numeric_type<T>, ExprScalar>) {
 		static_assert(sizeof(TExprType<T>) == sizeof(T));
 		std::get<TExprType<T>>(expr.value) = reinterpret_cast<TExprType<T> &>(inOutValue);
-		if constexpr(n == 1)
-			inOutValue = expr.expression.value();
-		else {
-			// Vector type
-			auto floatVal = expr.expression.value();
-			auto &results = expr.expression.results();
-			if(results.count() == 1 && results[0].type == type_t::e_vector) {
-				typename type_t::vector_view vv {results[0]};
-				if(vv.size() == n)
-					inOutValue = *reinterpret_cast<T *>(&vv[0]);
-			}
-			else {
-				// Expression returned a single float value?
-				// We'll assume it's intended to be interpreted as a vector
-				if constexpr(udm::is_vector_type<T>)
-					inOutValue = T {static_cast<typename T::value_type>(floatVal)};
-			}
-		}
 	}
 	else {
 		// Base type mismatch, we'll have to copy
 		auto &exprValue = std::get<TExprType<T>>(expr.value);
 		static_assert(std::tuple_size_v<std::remove_reference_t<decltype(exprValue)>> == n);
-		auto *ptrStart = reinterpret_cast<udm::underlying_numeric_type<T> *>(&inOutValue);
-		auto *ptr = ptrStart;
+		auto *ptr = reinterpret_cast<udm::underlying_numeric_type<T> *>(&inOutValue);
 		for(auto i = decltype(n) {0u}; i < n; ++i) {
 			exprValue[i] = *ptr;
 			++ptr;
 		}
-
-		if constexpr(n == 1)
-			inOutValue = expr.expression.value();
-		else {
-			// Vector type
-			auto floatVal = expr.expression.value();
-			auto &results = expr.expression.results();
-			if(results.count() == 1 && results[0].type == type_t::e_vector) {
-				typename type_t::vector_view vv {results[0]};
-				if(vv.size() == n) {
-					ptr = ptrStart;
-					for(auto i = decltype(n) {0u}; i < n; ++i) {
-						*ptr = vv[i];
-						++ptr;
-					}
-				}
-			}
-			else {
-				// Expression returned a single float value?
-				// We'll assume it's intended to be interpreted as a vector
-				if constexpr(udm::is_vector_type<T>)
-					inOutValue = T {static_cast<typename T::value_type>(floatVal)};
-			}
-		}
 	}
+
+	expr.valueAtCache.Reset(timeIndex);
+	EvaluationResult result;
+	compiledExpression.Evaluate(expr, result);
+	ApplyResult(result, inOutValue);
 }
 
 export {
@@ -0,0 +1,99 @@
+// SPDX-FileCopyrightText: (c) 2025 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+export module panima:instrumentation;
+
+export import pragma.udm;
+
+// Lightweight timers and counters for the hot paths of panima. The instrumentation is only compiled in if
+// PANIMA_ENABLE_INSTRUMENTATION is defined (see the CMake option of the same name), otherwise all of the
+// recording functions are no-ops and the stats remain empty.
+// Stats are recorded per thread without any synchronization between threads and can be pulled at any time.
+export namespace panima::instrumentation {
+#ifdef PANIMA_ENABLE_INSTRUMENTATION
+	constexpr bool ENABLED = true;
+#else
+	constexpr bool ENABLED = false;
+#endif
+	enum class Timer : uint32_t {
+		PlayerAdvance = 0u,
+		PoseSample,      // AnimationManager::SubmitPose
+		BindingApply,    // ChannelBindingTable::Apply
+		ExpressionApply, // Value expression evaluation, excluding constant expressions
+		AnimationLoad,
+		AnimationSave,
+
+		Count,
+	};
+	enum class Counter : uint32_t {
+		ChannelSample = 0u,
+		ChannelSampleSkipped,        // Channels that were skipped because their value was known to be unchanged
+		InterpolationCursorHit,      // The pivot index (or one of its neighbors) contained the time
+		InterpolationCursorFallback, // The pivot index was invalid or too far off, a binary search was required
+		InterpolationBinarySearch,   // All binary searches, including the ones without a pivot index
+		ArrayResize,                 // Keyframe array size changes, which may cause reallocations
+
+		Count,
+	};
+	struct TimerStats {
+		uint64_t count = 0;
+		uint64_t totalNs = 0;
+		uint64_t maxNs = 0;
+	};
+	struct Stats {
+		std::array<TimerStats, static_cast<size_t>(Timer::Count)> timers {};
+		std::array<uint64_t, static_cast<size_t>(Counter::Count)> counters {};
+
+		const TimerStats &GetTimer(Timer timer) const { return timers[static_cast<size_t>(timer)]; }
+		uint64_t GetCounter(Counter counter) const { return counters[static_cast<size_t>(counter)]; }
+		Stats &operator+=(const Stats &other);
+	};
+	struct ThreadStats {
+		std::thread::id threadId {};
+		Stats stats {};
+	};
+
+	std::string_view get_name(Timer timer);
+	std::string_view get_name(Counter counter);
+
+	// Stats of every thread that has recorded anything, including threads that have exited
+	std::vector<ThreadStats> get_thread_stats();
+	// Sum of the stats of all threads
+	Stats get_stats();
+	// Values that are being recorded by other threads during the reset may be lost
+	void reset_stats();
+
+	namespace detail {
+		void record_time(Timer timer, uint64_t ns);
+		void increment(Counter counter, uint64_t n);
+	};
+
+	inline void increment(Counter counter, uint64_t n = 1)
+	{
+		if constexpr(ENABLED)
+			detail::increment(counter, n);
+	}
+
+	class ScopedTimer {
+	  public:
+		ScopedTimer(Timer timer)
+		{
+			if constexpr(ENABLED) {
+				m_timer = timer;
+				m_start = std::chrono::steady_clock::now();
+			}
+		}
+		~ScopedTimer()
+		{
+			if constexpr(ENABLED)
+				detail::record_time(m_timer, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+		}
+		ScopedTimer(const ScopedTimer &) = delete;
+		ScopedTimer &operator=(const ScopedTimer &) = delete;
+	  private:
+		Timer m_timer = Timer::Count;
+		std::chrono::steady_clock::time_point m_start {};
+	};
+};
@@ -17,7 +17,27 @@ import :animation;
 export namespace panima {
 	class Player : public std::enable_shared_from_this<Player> {
 	  public:
-		enum class StateFlags : uint32_t { None = 0u, Looping = 1u, AnimationDirty = Looping << 1u };
+		enum class StateFlags : uint32_t { None = 0u, Looping = 1u, AnimationDirty = Looping << 1u, IncludeStartEvents = AnimationDirty << 1u, ForceSample = IncludeStartEvents << 1u };
+		struct LodPolicy {
+			enum class Mode : uint8_t {
+				// Sampled values are kept until the next sampled update
+				Hold = 0u,
+				// Output values are blended towards the most recent sample over the update interval,
+				// which adds up to one interval of latency
+				Interpolate,
+			};
+			// Channels are only sampled every n-th update
+			uint32_t updateInterval = 1;
+			// Offset of the sampled updates, can be used to spread multiple players over several updates
+			uint32_t phase = 0;
+			Mode mode = Mode::Hold;
+			// If enabled, low-priority channels are only sampled when a full update is forced and keep their last value otherwise
+			bool skipLowPriorityChannels = false;
+		};
+		struct TriggeredEvent {
+			uint32_t trackIndex = 0;
+			uint32_t eventIndex = 0;
+		};
 		static std::shared_ptr<Player> Create();
 		static std::shared_ptr<Player> Create(const Player &other);
 		static std::shared_ptr<Player> Create(Player &&other);
@@ -43,7 +63,24 @@ export namespace panima {
 		void Reset();
 
 		const Animation *GetAnimation() const { return m_animation.get(); }
+		// Level-of-detail for sampling. Advance always has to be called on every update, so that the time
+		// is accumulated correctly, but the channels only have to be sampled if ShouldSample returns true.
+		void SetLodPolicy(const LodPolicy &policy);
+		const LodPolicy &GetLodPolicy() const { return m_lodPolicy; }
+		// Index of the last update within the current update interval, 0 for updates that should be sampled
+		uint32_t GetLodUpdateIndex() const { return (m_lodPolicy.updateInterval > 1) ? (m_lodTick % m_lodPolicy.updateInterval) : 0; }
+		bool ShouldSample() const { return GetLodUpdateIndex() == 0; }
+		// True if the last update was forced to be a full update (e.g. after a reset)
+		bool IsFullUpdate() const { return m_lodFullUpdate; }
+
+		// Root motion between the previous and the current time of the last Advance call, including loop
+		// wrap-arounds. Requires the animation to have root motion (see Animation::ComputeRootMotion).
+		pragma::math::Transform GetRootMotionDelta() const;
+		// Events of the animation's event tracks that were crossed during the last Advance call, in playback order
+		const std::vector<TriggeredEvent> &GetTriggeredEvents() const { return m_triggeredEvents; }
 		uint32_t &GetLastChannelTimestampIndex(AnimationChannelId channelId) { return m_lastChannelTimestampIndices[channelId]; }
+		// Does not include the animation
+		size_t GetMemoryUsage() const;
 
 		Player &operator=(const Player &other);
 		Player &operator=(Player &&other);
@@ -60,8 +97,15 @@ export namespace panima {
 		float m_playbackRate = 1.f;
 		float m_currentTime = 0.f;
 		StateFlags m_stateFlags = StateFlags::None;
+		float m_previousTime = 0.f;
+		// Number of times the animation has looped during the last Advance call, negative for negative playback rates
+		int32_t m_previousLoopCount = 0;
+		LodPolicy m_lodPolicy {};
+		uint32_t m_lodTick = 0;
+		bool m_lodFullUpdate = true;
 
 		std::vector<uint32_t> m_lastChannelTimestampIndices;
+		std::vector<TriggeredEvent> m_triggeredEvents;
 	};
 	using PPlayer = std::shared_ptr<Player>;
 	using namespace pragma::math::scoped_enum::bitwise;
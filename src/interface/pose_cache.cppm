@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText: (c) 2025 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+export module panima:pose_cache;
+
+import :animation;
+import :slice;
+import :types;
+
+export namespace panima {
+	// Bounded cache of sampled poses keyed by animation and quantized time, with least-recently-used eviction.
+	// Intended for repeated seeks to the same times, e.g. timeline scrubbing or replays. Entries are invalidated
+	// automatically if the animation has been modified since (see Animation::GetRevision).
+	// The cache is not thread-safe.
+	class PoseCache {
+	  public:
+		struct CachedPose {
+			Pose pose;
+			// Time index of every channel at the cached time, can be used as pivot for subsequent samples
+			std::vector<uint32_t> timestampIndices;
+		};
+		PoseCache(uint32_t capacity = 64, float timeQuantization = 1.f / 120.f);
+
+		void SetCapacity(uint32_t capacity);
+		uint32_t GetCapacity() const { return m_capacity; }
+		// Changing the quantization clears the cache
+		void SetTimeQuantization(float quantization);
+		float GetTimeQuantization() const { return m_timeQuantization; }
+		// Returns the time that poses for time t are sampled and cached at
+		float GetQuantizedTime(float t) const;
+
+		// Returns nullptr if there is no valid entry for the animation at the (quantized) time
+		const CachedPose *Find(const Animation &anim, float t);
+		void Insert(const Animation &anim, float t, const Pose &pose, std::vector<uint32_t> timestampIndices);
+		void Invalidate(const Animation &anim);
+		void Clear();
+		size_t GetSize() const { return m_entries.size(); }
+		size_t GetMemoryUsage() const;
+
+		uint64_t GetHitCount() const { return m_hitCount; }
+		uint64_t GetMissCount() const { return m_missCount; }
+	  private:
+		struct Key {
+			const Animation *animation = nullptr;
+			int64_t timeKey = 0;
+			bool operator==(const Key &other) const { return animation == other.animation && timeKey == other.timeKey; }
+		};
+		struct KeyHash {
+			size_t operator()(const Key &key) const;
+		};
+		struct Entry {
+			Key key;
+			std::weak_ptr<const Animation> animation {};
+			uint64_t revision = 0;
+			CachedPose pose;
+		};
+		int64_t GetTimeKey(float t) const;
+		void Erase(std::list<Entry>::iterator it);
+		// Most recently used entries first
+		std::list<Entry> m_entries;
+		std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_lookup;
+		uint32_t m_capacity = 64;
+		float m_timeQuantization = 1.f / 120.f;
+		uint64_t m_hitCount = 0;
+		uint64_t m_missCount = 0;
+	};
+};
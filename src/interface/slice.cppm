@@ -6,6 +6,7 @@ module;
 export module panima:slice;
 
 export import pragma.udm;
+import :types;
 
 export namespace panima {
 	struct Slice {
@@ -16,4 +17,40 @@ export namespace panima {
 		Slice &operator=(Slice &&) = default;
 		std::vector<udm::PProperty> channelValues;
 	};
+
+	// Sampled values of all channels of an animation, grouped by value type
+	struct Pose {
+		struct Group {
+			udm::Type type = udm::Type::Invalid;
+			std::vector<AnimationChannelId> channelIds;
+			// Tightly packed values of type 'type', in the same order as channelIds.
+			// It is the caller's responsibility to ensure that T matches the type.
+			std::vector<uint8_t> values;
+
+			template<typename T>
+			std::span<const T> GetValues() const
+			{
+				return {reinterpret_cast<const T *>(values.data()), channelIds.size()};
+			}
+			template<typename T>
+			std::span<T> GetValues()
+			{
+				return {reinterpret_cast<T *>(values.data()), channelIds.size()};
+			}
+		};
+		std::vector<Group> groups;
+		// Channels whose values have changed since the previous submission, in no particular order
+		std::vector<AnimationChannelId> changedChannels;
+		uint32_t channelCount = 0;
+
+		// Size of the heap buffers
+		size_t GetMemoryUsage() const
+		{
+			auto size = groups.capacity() * sizeof(Group) + changedChannels.capacity() * sizeof(AnimationChannelId);
+			for(auto &group : groups)
+				size += group.channelIds.capacity() * sizeof(AnimationChannelId) + group.values.capacity();
+			return size;
+		}
+	};
+	using PoseSubmitter = std::function<void(const Pose &)>;
 };
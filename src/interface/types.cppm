@@ -24,6 +24,35 @@ export namespace panima {
 		float duration = -1.f;
 	};
 
+	// Approximate memory usage in bytes, broken down by category
+	struct MemoryUsage {
+		// Uncompressed keyframe times and values
+		size_t keyframes = 0;
+		// Compressed keyframe storage (lz4 arrays)
+		size_t compressedKeyframes = 0;
+		// Value expressions. Compiled expressions are shared, so their size is split evenly between their users.
+		size_t expressions = 0;
+		size_t events = 0;
+		size_t rootMotion = 0;
+		// Lookup indices, caches and sampling buffers
+		size_t caches = 0;
+		// Object sizes and other bookkeeping
+		size_t objects = 0;
+
+		size_t GetTotal() const { return keyframes + compressedKeyframes + expressions + events + rootMotion + caches + objects; }
+		MemoryUsage &operator+=(const MemoryUsage &other)
+		{
+			keyframes += other.keyframes;
+			compressedKeyframes += other.compressedKeyframes;
+			expressions += other.expressions;
+			events += other.events;
+			rootMotion += other.rootMotion;
+			caches += other.caches;
+			objects += other.objects;
+			return *this;
+		}
+	};
+
 	using AnimationId = uint32_t;
 	constexpr auto INVALID_ANIMATION = std::numeric_limits<AnimationId>::max();
 	using AnimationChannelId = uint16_t;
@@ -43,3 +72,12 @@ export namespace panima {
 			return T {};
 	}
 };
+
+namespace panima {
+	// Estimate for node-based hash maps: one node per element plus the bucket array
+	template<typename TMap>
+	size_t get_hash_map_memory_usage(const TMap &map)
+	{
+		return map.size() * (sizeof(typename TMap::value_type) + sizeof(void *) * 2) + map.bucket_count() * sizeof(void *);
+	}
+};
@@ -9,8 +9,11 @@ export module panima;
 export import :animation;
 export import :animation_manager;
 export import :animation_set;
+export import :binding;
 export import :channel;
+export import :instrumentation;
 export import :player;
+export import :pose_cache;
 export import :slice;
 export import :types;
 export import :expression;